@@ -0,0 +1,38 @@
+#ifndef __KCOMPAT_H
+#define __KCOMPAT_H
+
+/* Just enough of the kernel API for t6963.c to build as a userspace program.
+ * Only the simulator bus is any use out here, the parallel port functions
+ * compile but never touch real hardware.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define __user
+#define __init
+#define __exit
+
+#define MODULE_LICENSE(x)
+#define module_param(name, type, perm)
+#define module_param_array(name, type, nump, perm)
+
+typedef int spinlock_t;
+#define SPIN_LOCK_UNLOCKED              0
+#define spin_lock_irqsave(lock, flags)  ((void)(lock), (flags)=0)
+#define spin_unlock_irqrestore(lock, flags) ((void)(flags))
+
+/* the driver is chatty on reset and clear, keep the benchmark output clean */
+static inline int printk(const char *fmt, ...) { return 0; }
+
+static inline void outb(u8 value, unsigned short port) { }
+static inline u8 inb(unsigned short port) { return 0xff; }
+static inline void ndelay(unsigned long ns) { }
+
+#endif
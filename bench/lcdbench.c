@@ -0,0 +1,295 @@
+/*******************************************************************************
+ * T6963C bus cost benchmark
+ *
+ * Builds the driver's transfer layer (t6963.c) in userspace on top of the
+ * simulator bus and replays typical workloads through it. For each workload
+ * and driver configuration it reports what one frame costs on the bus: port
+ * reads and writes, time spent in bus delays, commands, data bytes and an
+ * estimate of the wall time on a real parallel port.
+ *
+ * The "baseline" configuration pushes every byte through lcd_write_bytes()
+ * after one lcd_cmd_long(CMD_ADDR_PTR) like the original driver did, "runs"
+ * sends every changed run as its own auto write like the driver did before
+ * the transfer planner, the others are what the current driver does with its
+ * default and opt-in settings.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../t6963.c"
+#include "../logofiles/bitshift.h"
+
+#define FRAME_SIZE      (8*lcd_stat.row_width*lcd_stat.rows)
+#define PLANES          6
+
+/* how long one port access takes, an ISA parallel port is about 1us */
+static unsigned long port_ns=1000;
+static int frames=100;
+
+static u8 frame[LCD_RAM_SIZE];
+static u8 map[2*LCD_RAM_SIZE];
+static unsigned int map_width;
+
+struct config {
+    const char *name;
+    int shadow_writes;
+    int plan;
+    int burst_check;
+};
+
+static struct config configs[] = {
+    { "baseline",   0, 0, 0 },
+    { "runs",       1, 0, 0 },
+    { "driver",     1, 1, 0 },
+    { "burst16",    1, 1, 16 },
+};
+#define NCONFIGS        (sizeof(configs)/sizeof(configs[0]))
+
+struct workload {
+    const char *name;
+    void (*setup)(void);
+    void (*frame)(int n);
+};
+
+static unsigned long lcg=1;
+
+static unsigned int rnd(void) {
+    lcg=lcg*1103515245+12345;
+    return (lcg>>16)&0x7fff;
+}
+
+/* something that looks like a scrolling logo, blobs on a plain background */
+static void make_map(unsigned int width) {
+    unsigned int i, rows=8*lcd_stat.rows;
+
+    map_width=width;
+    memset(map, 0x00, map_width*rows);
+    for(i=0;i<map_width*rows/4;i++)
+        map[rnd()%(map_width*rows)]=rnd();
+}
+
+/* copy a row_width wide window of the map starting px pixels in */
+static void map_window(u8 *dst, unsigned int px) {
+    bitshift_window(dst, lcd_stat.row_width, map, map_width, 8*lcd_stat.rows, 
+            px, lcd_stat.row_width);
+}
+
+/* logo -s: render the next pixel step into the back buffer and flip */
+static void scroll_setup(void) {
+    make_map(2*lcd_stat.row_width);
+}
+
+static void scroll_frame(int n) {
+    unsigned int base=lcd_stat.graphics_base+(n&1)*FRAME_SIZE;
+
+    map_window(frame, n);
+    lcd_write_diff(base, frame, FRAME_SIZE);
+    lcd_cmd_long(base-2, CMD_GRAPHIC_HOME_ADDR);
+}
+
+/* logo -b: graphics rows as wide as the driver allows over a map that's
+ * wider still. Every step moves the home address a byte and uploads the
+ * column that comes into view next, at the end of the canvas the screen is
+ * copied to its start and the viewport jumps back.
+ */
+static unsigned int vp_width, vp_col, vp_x;
+
+/* count columns of the map starting at map column col to canvas column x */
+static void viewport_columns(unsigned int x, unsigned int col, unsigned int count) {
+    unsigned int y, i;
+
+    for(y=0;y<8*lcd_stat.rows;y++) {
+        for(i=0;i<count;i++)
+            frame[i]=map[y*map_width+(col+i)%map_width];
+        lcd_write_diff(lcd_stat.graphics_base+y*vp_width+x, frame, count);
+    }
+}
+
+static void viewport_setup(void) {
+    make_map(sizeof(map)/(8*lcd_stat.rows));
+
+    vp_width=(lcd_stat.graphics_end-lcd_stat.graphics_base)/(8*lcd_stat.rows);
+    if(vp_width>0xff)
+        vp_width=0xff;
+    lcd_cmd_d2(vp_width, 0, CMD_GRAPHIC_AREA_SET);
+    vp_col=vp_x=0;
+    viewport_columns(0, 0, lcd_stat.cols+1);
+}
+
+static void viewport_frame(int n) {
+    if(vp_x+lcd_stat.cols>=vp_width) {
+        vp_col=(vp_col+vp_x)%map_width;
+        vp_x=0;
+        viewport_columns(0, vp_col, lcd_stat.cols);
+    } else {
+        vp_x++;
+    }
+    lcd_cmd_long(lcd_stat.graphics_base+vp_x-2, CMD_GRAPHIC_HOME_ADDR);
+    if(vp_x+lcd_stat.cols<vp_width)
+        viewport_columns(vp_x+lcd_stat.cols, vp_col+vp_x+lcd_stat.cols, 1);
+}
+
+/* grayscale: upload all the bitplanes of a new image */
+static void gray_frame(int n) {
+    unsigned int p, x, y, base;
+    int level;
+
+    for(p=0;p<PLANES;p++) {
+        base=lcd_stat.graphics_base+p*FRAME_SIZE;
+        if(base+FRAME_SIZE>LCD_RAM_SIZE)
+            break;
+        memset(frame, 0x00, FRAME_SIZE);
+        for(y=0;y<8*lcd_stat.rows;y++) {
+            for(x=0;x<8*lcd_stat.cols;x++) {
+                // a diagonal gradient that moves a little every frame
+                level=((x+y+n)%(8*lcd_stat.cols))*PLANES/(8*lcd_stat.cols);
+                if(level<=p)
+                    frame[y*lcd_stat.row_width+x/8] |= 0x80>>(x%8);
+            }
+        }
+        lcd_write_diff(base, frame, FRAME_SIZE);
+    }
+}
+
+/* a console: scroll up a line and print a new one */
+static char text[LCD_SIZE+1];
+
+static void text_setup(void) {
+    memset(text, ' ', LCD_SIZE);
+}
+
+static void text_frame(int n) {
+    char line[LCD_COLS+1];
+    unsigned int i;
+
+    memmove(text, text+LCD_COLS, LCD_SIZE-LCD_COLS);
+    snprintf(line, sizeof(line), "eth0: rx %6d tx %6d ok",
+            (n*37)%1000000, (n*11)%1000000);
+    memcpy(text+LCD_SIZE-LCD_COLS, line, LCD_COLS);
+
+    for(i=0;i<LCD_ROWS;i++)
+        lcd_write_text_at(lcd_stat.text_base+i*LCD_COLS, (u8*)text+i*LCD_COLS,
+                LCD_COLS);
+}
+
+/* clearing between scenes, a scene with a few things on it and then a clear */
+static void clear_frame(int n) {
+    unsigned int i;
+
+    memset(frame, 0x00, FRAME_SIZE);
+    for(i=0;i<FRAME_SIZE/8;i++)
+        frame[rnd()%FRAME_SIZE]=rnd();
+    lcd_write_diff(lcd_stat.graphics_base, frame, FRAME_SIZE);
+    lcd_graphics_clear();
+}
+
+/* a dashboard that blinks a few indicators, uploaded as whole frames */
+static void sparse_setup(void) {
+    unsigned int i;
+
+    for(i=0;i<FRAME_SIZE;i++)
+        frame[i]=rnd();
+}
+
+static void sparse_frame(int n) {
+    unsigned int i;
+
+    for(i=0;i<8;i++)
+        frame[(i*157+n*3)%FRAME_SIZE]^=0x18;
+    lcd_write_diff(lcd_stat.graphics_base, frame, FRAME_SIZE);
+}
+
+static struct workload workloads[] = {
+    { "logo scroll",    scroll_setup,   scroll_frame },
+    { "viewport scroll", viewport_setup, viewport_frame },
+    { "grayscale",      NULL,           gray_frame },
+    { "text churn",     text_setup,     text_frame },
+    { "scene + clear",  NULL,           clear_frame },
+    { "sparse update",  sparse_setup,   sparse_frame },
+};
+#define NWORKLOADS      (sizeof(workloads)/sizeof(workloads[0]))
+
+/* everything the driver believes is on the LCD has to actually be there */
+static int check_shadow(void) {
+    unsigned int a, bad=0;
+
+    for(a=0;a<LCD_RAM_SIZE;a++) {
+        if(LCD_KNOWN(a) && lcd_shadow[a]!=lcd_sim.ram[a])
+            bad++;
+    }
+    if(lcd_sim.errors)
+        printf("    %lu commands the T6963C would have rejected\n", lcd_sim.errors);
+    if(bad)
+        printf("    %u bytes of the shadow don't match the LCD\n", bad);
+    return bad || lcd_sim.errors;
+}
+
+static int run(const struct workload *w, const struct config *c) {
+    struct lcd_bus_stats *st=&lcd_bus_stats;
+    double wall;
+    int n;
+
+    lcd_shadow_writes=c->shadow_writes;
+    lcd_plan=c->plan;
+    lcd_burst_check=c->burst_check;
+    lcg=1;
+
+    lcd_bus_type="sim";
+    if(lcd_reset(LCD_ROWS, LCD_COLS)<0) {
+        printf("reset failed\n");
+        return 1;
+    }
+    if(w->setup)
+        w->setup();
+
+    memset(st, 0, sizeof(*st));
+    for(n=0;n<frames;n++)
+        w->frame(n);
+
+    wall=(double)(st->port_reads+st->port_writes)*port_ns+st->delay_ns;
+    printf("  %-9s %9.1f %9.1f %9.1f %7.1f %8.1f %9.3f %8.1f\n", c->name,
+            (double)st->port_reads/frames, (double)st->port_writes/frames,
+            (double)st->delay_ns/frames/1000, (double)st->cmds/frames,
+            (double)st->data_writes/frames, wall/frames/1000000,
+            wall ? frames*1e9/wall : 0);
+
+    return check_shadow();
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int i, j;
+    int opt, err=0;
+
+    while((opt=getopt(argc, argv, "f:p:"))!=-1) {
+        switch(opt) {
+            case 'f':
+                frames=atoi(optarg);
+                break;
+            case 'p':
+                port_ns=atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [-f frames] [-p port access ns]\n", argv[0]);
+                exit(-1);
+        }
+    }
+    if(frames<1)
+        frames=1;
+
+    printf("%d frames per workload, %lu ns per port access, costs per frame\n\n",
+            frames, port_ns);
+    for(i=0;i<NWORKLOADS;i++) {
+        printf("%s\n", workloads[i].name);
+        printf("  %-9s %9s %9s %9s %7s %8s %9s %8s\n", "config", "port rd",
+                "port wr", "delay us", "cmds", "bytes", "est ms", "fps");
+        for(j=0;j<NCONFIGS;j++)
+            err|=run(&workloads[i], &configs[j]);
+        printf("\n");
+    }
+
+    if(err)
+        printf("simulated LCD and driver disagree!\n");
+    return err;
+}
@@ -1,50 +1,122 @@
+/*******************************************************************************
+ * T6963C text console
+ *
+ * Puts a virtual console on the text area of the LCD. Characters go through
+ * the shadow of display RAM, so a run handed to putcs only costs one address
+ * and one auto write for the part that actually changed. Scrolling the whole
+ * screen moves CMD_TEXT_HOME_ADDR down a ring of text rows instead of writing
+ * the screen again, and cursor moves are collected and sent once things have
+ * been quiet for a moment.
+ *
+ ******************************************************************************/
+
 #include <linux/tty.h>
 #include <linux/console.h>
+#include <linux/vt_kern.h>
+#include <linux/workqueue.h>
 #include <linux/string.h>
 
 #include "t6963.c"
 
-u16 framebuffer[LCD_SIZE];
-
-
 static int lcd_first_vc = 1;
 static int lcd_last_vc  = 16;
 static struct vc_data *lcd_display_fg = NULL;
 
-static enum { TYPE_LCD } lcd_type;
 static char *lcd_type_name;
 
 module_param(lcd_first_vc, int, 0);
 module_param(lcd_last_vc, int, 0);
 
-static const char __init *lcdcon_startup(void) {
-    lcd_num_col = LCD_COLS;
-    lcd_num_row = LCD_ROWS;
+/* text rows in the scroll ring, the screen shows LCD_ROWS of them at a time
+ * and the ring only has to be copied back to its start every lcd_con_ring -
+ * LCD_ROWS scrolls
+ */
+static int lcd_con_ring = 64;
+module_param(lcd_con_ring, int, 0);
 
-    lcd_graphics_base = 0x00;
-    
-    /* XXX: set cursor?? */
+static unsigned int lcd_con_top;        // ring row shown at the top of the screen
 
-    lcd_type_name = "generic Toshiba T6963C";
-    lcd_type = TYPE_LCD;
+/* where the cursor should be and where the LCD has it */
+#define LCD_CURSOR_DELAY    (HZ/50)
 
-    printk("t6963: display startup.\n");
+static int lcd_cur_x, lcd_cur_y, lcd_cur_on;
+static int lcd_cur_sent_x=-1, lcd_cur_sent_y=-1, lcd_cur_sent_on=-1;
 
-    return "T6963";
+/* one row of character codes on the way from the shadow back to the LCD, or
+ * of characters on the way to lcd_write_text_at()
+ */
+static u8 lcd_con_row[LCD_COLS];
+
+/* text RAM address of screen position x,y */
+static inline unsigned int lcdcon_addr(int y, int x) {
+    return lcd_stat.text_base+(lcd_con_top+y)*LCD_COLS+x;
+}
+
+/* copy count characters from screen position sy,sx to dy,dx */
+static void lcdcon_copy(int sy, int sx, int dy, int dx, int count) {
+    memcpy(lcd_con_row, lcd_shadow+lcdcon_addr(sy, sx), count);
+    lcd_write_diff(lcdcon_addr(dy, dx), lcd_con_row, count);
 }
 
-static void lcd_clear_text_area(void) {
-    u16 i;
+static void lcdcon_blank_row(int y, int x, int count) {
+    memset(lcd_con_row, 0x00, count);
+    lcd_write_diff(lcdcon_addr(y, x), lcd_con_row, count);
+}
+
+static void lcdcon_set_home(void) {
+    lcd_set_text_home(lcdcon_addr(0, 0));
+}
 
-    // clear the framebuffer
-    for(i=0; i<LCD_SIZE;i++) {
-        framebuffer[i]=0;
+static void lcdcon_cursor_update(void) {
+    if(lcd_cur_on && (lcd_cur_x!=lcd_cur_sent_x || lcd_cur_y!=lcd_cur_sent_y)) {
+        lcd_pos_cursor(lcd_cur_x, lcd_cur_y);
+        lcd_cur_sent_x=lcd_cur_x;
+        lcd_cur_sent_y=lcd_cur_y;
     }
+    if(lcd_cur_on!=lcd_cur_sent_on) {
+        if(lcd_cur_on)
+            lcd_enable_cursor();
+        else
+            lcd_disable_cursor();
+        lcd_cur_sent_on=lcd_cur_on;
+    }
+}
 
-    // clear the lcd screen
-    lcd_pos_cursor(0,0);
+static void lcdcon_cursor_work(struct work_struct *work) {
+    acquire_console_sem();
+    lcdcon_cursor_update();
+    release_console_sem();
+}
+
+static DECLARE_DELAYED_WORK(lcdcon_cursor_delayed, lcdcon_cursor_work);
+
+static const char __init *lcdcon_startup(void) {
+    if(lcd_con_ring<LCD_ROWS)
+        lcd_con_ring=LCD_ROWS;
 
-    lcd_cmd_long(lcd_graphics_base,CMD_ADDR_PTR); 
+    if(lcd_reset(LCD_ROWS, LCD_COLS)<0)
+        printk("t6963: reset failed!\n");
+
+    // the text ring goes where the graphics area was, we only show text
+    lcd_stat.graphics_base=lcd_stat.text_base+lcd_con_ring*LCD_COLS;
+    if(lcd_stat.graphics_base+8*lcd_stat.row_width*LCD_ROWS>LCD_RAM_SIZE) {
+        lcd_con_ring=LCD_ROWS+2;
+        lcd_stat.graphics_base=lcd_stat.text_base+lcd_con_ring*LCD_COLS;
+    }
+    lcd_cmd_long(lcd_stat.graphics_base-2, CMD_GRAPHIC_HOME_ADDR);
+    lcd_text_clear();
+
+    lcd_con_top=0;
+    lcdcon_set_home();
+    lcd_disable_graphics();
+    lcd_enable_text();
+    lcd_cur_sent_on=1;
+
+    lcd_type_name = "generic Toshiba T6963C";
+    printk("t6963: console on %s, %d row scroll ring\n", lcd_type_name,
+            lcd_con_ring);
+
+    return "T6963";
 }
 
 static void lcdcon_init(struct vc_data *c, int init) {
@@ -52,58 +124,165 @@ static void lcdcon_init(struct vc_data *c, int init) {
     c->vc_display_fg = &lcd_display_fg;
 
     if(init) {
-        c->vc_cols=lcd_num_col;
-        c->vc_rows=lcd_num_row;
+        c->vc_cols=LCD_COLS;
+        c->vc_rows=LCD_ROWS;
     } else {
-        vc_resize(c->vc_num, lcd_num_col, lcd_num_row);
+        vc_resize(c, LCD_COLS, LCD_ROWS);
     }
-    
+
     /* make the first LCD console visible */
     if(lcd_display_fg == NULL)
         lcd_display_fg = c;
-
-    MOD_INC_USE_COUNT;
 }
 
 static void lcdcon_deinit(struct vc_data *c) {
-    if(mda_display_fg == c)
-        mda_display_fg = NULL;
+    if(lcd_display_fg == c)
+        lcd_display_fg = NULL;
+}
+
+static void lcdcon_clear(struct vc_data *c, int y, int x, int height, int width) {
+    if(c != lcd_display_fg || width<=0)
+        return;
 
-    MOD_DEC_USE_COUNT;
+    // whole rows are next to each other in the ring
+    if(x==0 && width==LCD_COLS) {
+        memset(lcd_text_codes, 0x00, height*LCD_COLS);
+        lcd_write_diff(lcdcon_addr(y, 0), lcd_text_codes, height*LCD_COLS);
+        return;
+    }
+    for(;height>0;height--,y++)
+        lcdcon_blank_row(y, x, width);
 }
 
-static inline u16 lcd_convert_attr(u16 ch) {
+static void lcdcon_putcs(struct vc_data *c, const unsigned short *s, int count,
+        int y, int x) {
+    int i;
+
+    if(c != lcd_display_fg || count<=0)
+        return;
+    if(count>LCD_COLS-x)
+        count=LCD_COLS-x;
 
-static inline u16 lcd_convert_attr(u16 ch)
-{
-    /* only reverse, blinking and reverse+blinking supported */
-    /* underline simulated by reverse */
-    u16 attr=0;
+    // through the same charset as the character device, so 0x80-0x9f are
+    // the ROM's extended characters here too
+    for(i=0;i<count;i++)
+        lcd_con_row[i]=scr_readw(s+i) & 0xff;
+    lcd_write_text_at(lcdcon_addr(y, x), lcd_con_row, count);
+}
+
+static void lcdcon_putc(struct vc_data *c, int ch, int y, int x) {
+    unsigned short s=ch;
 
-#ifdef LCD_DEBUG
-        printk(KERN_DEBUG "mdacon.c for lcd: mdacon_convert_attr %i\n",ch);
-#endif
+    lcdcon_putcs(c, &s, 1, y, x);
+}
 
-    if (ch & 0x8000) {
-        // blink
-        attr |= 0x0800;
+static void lcdcon_cursor(struct vc_data *c, int mode) {
+    if(c != lcd_display_fg)
+        return;
+
+    if(mode==CM_ERASE) {
+        lcd_cur_on=0;
+    } else {
+        lcd_cur_on=1;
+        lcd_cur_x=c->vc_x;
+        lcd_cur_y=c->vc_y;
     }
-    if (ch & 0x1000) {
-        // reverse
-        attr |= 0x0500;
+    // the vt code erases and redraws the cursor around every write, only
+    // the state it's left in matters
+    schedule_delayed_work(&lcdcon_cursor_delayed, LCD_CURSOR_DELAY);
+}
+
+/* scroll the whole screen up by moving the text home address down the ring */
+static void lcdcon_scroll_ring(int lines) {
+    int y;
+
+    // out of ring, start over at the top with what stays on screen
+    if(lcd_con_top+lines+LCD_ROWS>lcd_con_ring) {
+        for(y=lines;y<LCD_ROWS;y++) {
+            memcpy(lcd_con_row, lcd_shadow+lcdcon_addr(y, 0), LCD_COLS);
+            lcd_write_diff(lcd_stat.text_base+(y-lines)*LCD_COLS, lcd_con_row,
+                    LCD_COLS);
+        }
+        lcd_con_top=0;
+    } else {
+        lcd_con_top+=lines;
     }
-    if (ch & 0x0800) {
-        // underline, simulate by reverse
-        attr |= 0x0500;
+
+    for(y=LCD_ROWS-lines;y<LCD_ROWS;y++)
+        lcdcon_blank_row(y, 0, LCD_COLS);
+    lcdcon_set_home();
+}
+
+/* everything else is copied row by row out of the shadow */
+static int lcdcon_scroll(struct vc_data *c, int t, int b, int dir, int lines) {
+    int y;
+
+    if(c != lcd_display_fg || lines<=0)
+        return 0;
+    if(lines>b-t)
+        lines=b-t;
+
+    if(dir==SM_UP && t==0 && b==LCD_ROWS && lines<LCD_ROWS) {
+        lcdcon_scroll_ring(lines);
+        return 0;
+    }
+
+    if(dir==SM_UP) {
+        for(y=t;y<b-lines;y++)
+            lcdcon_copy(y+lines, 0, y, 0, LCD_COLS);
+        for(;y<b;y++)
+            lcdcon_blank_row(y, 0, LCD_COLS);
+    } else {
+        for(y=b-1;y>=t+lines;y--)
+            lcdcon_copy(y-lines, 0, y, 0, LCD_COLS);
+        for(;y>=t;y--)
+            lcdcon_blank_row(y, 0, LCD_COLS);
+    }
+    // the vt code still moves its own copy of the screen
+    return 0;
+}
+
+static void lcdcon_bmove(struct vc_data *c, int sy, int sx, int dy, int dx,
+        int height, int width) {
+    int i;
+
+    if(c != lcd_display_fg || width<=0)
+        return;
+
+    if(dy<=sy) {
+        for(i=0;i<height;i++)
+            lcdcon_copy(sy+i, sx, dy+i, dx, width);
+    } else {
+        for(i=height-1;i>=0;i--)
+            lcdcon_copy(sy+i, sx, dy+i, dx, width);
     }
+}
+
+static int lcdcon_switch(struct vc_data *c) {
+    // redraw everything, putcs only sends what differs
+    return 1;
+}
+
+static int lcdcon_blank(struct vc_data *c, int blank, int mode_switch) {
+    if(blank)
+        lcd_disable_text();
+    else
+        lcd_enable_text();
+    return 0;
+}
+
+static int lcdcon_set_palette(struct vc_data *c, unsigned char *table) {
+    return -EINVAL;
+}
 
-    return (ch & 0x00ff) | attr;
+static int lcdcon_scrolldelta(struct vc_data *c, int lines) {
+    return 0;
 }
 
 static u8 lcdcon_build_attr(struct vc_data *c, u8 color, u8 intensity,
-        u8 blink, u8 underline, u8 reverse) {
+        u8 blink, u8 underline, u8 reverse, u8 italic) {
     /* The attribute is just a bit vector:
-     *  
+     *
      *  Bit 0..1 : intensity (0..2)
      *  Bit 2    : underline
      *  Bit 3    : reverse
@@ -117,25 +296,13 @@ static u8 lcdcon_build_attr(struct vc_data *c, u8 color, u8 intensity,
 }
 
 static void lcdcon_invert_region(struct vc_data *c, u16 *p, int count) {
-    /*
-    for(; count > 0; count--) {
-        scr_writew(scr_readw(p) ^ 0x0800, p);
-        p++;
-    }
-    */
-}
-
-static void lcdcon_putc(struct vc_data *c, int ch, int y, int x) {
-    u16 pos;
-
-    pos=LCD_POS(x,y);
-
-    /* XXX: STOPPED HERE 4am */
-    lcd_cmd_long(pos, CMD_ADDR_PTR); /* set the address */
-    lcd_write(ch);
+    /* attributes need the text attribute mode, which takes the graphics
+     * area away from us, so there's nothing to invert with
+     */
 }
 
 const struct consw lcd_con = {
+    .owner =                THIS_MODULE,
     .con_startup =          lcdcon_startup,
     .con_init =             lcdcon_init,
     .con_deinit =           lcdcon_deinit,
@@ -147,7 +314,6 @@ const struct consw lcd_con = {
     .con_bmove =            lcdcon_bmove,
     .con_switch =           lcdcon_switch,
     .con_blank =            lcdcon_blank,
-    .con_font_op =          lcdcon_font_op,
     .con_set_palette =      lcdcon_set_palette,
     .con_scrolldelta =      lcdcon_scrolldelta,
     .con_build_attr =       lcdcon_build_attr,
@@ -155,15 +321,23 @@ const struct consw lcd_con = {
 };
 
 int __init lcd_console_init(void) {
+    int err;
+
     if(lcd_first_vc > lcd_last_vc)
         return 1;
 
-    take_over_console(&lcd_con, lcd_first_vc-1, lcd_last_vc-1, 0);
-    return 0
+    if((err=lcd_claim_port("lcdcon"))<0)
+        return err;
+    if((err=take_over_console(&lcd_con, lcd_first_vc-1, lcd_last_vc-1, 0)))
+        lcd_release_port();
+    return err;
 }
 
 void __exit lcd_console_exit(void) {
     give_up_console(&lcd_con);
+    cancel_delayed_work(&lcdcon_cursor_delayed);
+    flush_scheduled_work();
+    lcd_release_port();
 }
 
 module_init(lcd_console_init);
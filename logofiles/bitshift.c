@@ -0,0 +1,95 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitshift.h"
+
+/* eight bytes as one word, first byte most significant like the pixels */
+static inline unsigned long long load_be64(const unsigned char *p) {
+    unsigned long long w;
+
+    memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w=__builtin_bswap64(w);
+#endif
+    return w;
+}
+
+static inline void store_be64(unsigned char *p, unsigned long long w) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w=__builtin_bswap64(w);
+#endif
+    memcpy(p, &w, sizeof(w));
+}
+
+#ifdef __SSE2__
+// 16 bytes at a time, returns how many were done
+static unsigned int shift_sse2(unsigned char *dst, const unsigned char *src,
+        unsigned int n, unsigned int s) {
+    // there are no byte shifts, shift words and mask off what crossed over
+    __m128i hi=_mm_set1_epi8((char)(0xff<<s));
+    __m128i lo=_mm_set1_epi8((char)(0xff>>(8-s)));
+    __m128i left=_mm_cvtsi32_si128(s), right=_mm_cvtsi32_si128(8-s);
+    __m128i a, b;
+    unsigned int i;
+
+    for(i=0;i+16<=n;i+=16) {
+        a=_mm_loadu_si128((const __m128i*)(src+i));
+        b=_mm_loadu_si128((const __m128i*)(src+i+1));
+        a=_mm_and_si128(_mm_sll_epi16(a, left), hi);
+        b=_mm_and_si128(_mm_srl_epi16(b, right), lo);
+        _mm_storeu_si128((__m128i*)(dst+i), _mm_or_si128(a, b));
+    }
+    return i;
+}
+#endif
+
+/* n bytes shifted left by s bits out of src, which has n+1 bytes to read */
+static void shift_run(unsigned char *dst, const unsigned char *src,
+        unsigned int n, unsigned int s) {
+    unsigned int i=0;
+
+    if(!s) {
+        memcpy(dst, src, n);
+        return;
+    }
+#ifdef __SSE2__
+    i=shift_sse2(dst, src, n, s);
+#endif
+    for(;i+8<=n;i+=8)
+        store_be64(dst+i, load_be64(src+i)<<s | src[i+8]>>(8-s));
+    for(;i<n;i++)
+        dst[i]=src[i]<<s | src[i+1]>>(8-s);
+}
+
+void bitshift_row(unsigned char *dst, const unsigned char *row,
+        unsigned int rowlen, unsigned long px, unsigned int width) {
+    unsigned int i=0, pos, run, s=px%8;
+
+    while(i<width) {
+        pos=(px/8+i)%rowlen;
+
+        // everything up to the last byte of the row in one go
+        run=rowlen-pos-1;
+        if(run>width-i)
+            run=width-i;
+        shift_run(dst+i, row+pos, run, s);
+        i+=run;
+
+        // the byte that takes its low bits from the start of the row
+        if(i<width) {
+            pos=(px/8+i)%rowlen;
+            dst[i++]=row[pos]<<s | (s ? row[(pos+1)%rowlen]>>(8-s) : 0);
+        }
+    }
+}
+
+void bitshift_window(unsigned char *dst, unsigned int stride,
+        const unsigned char *src, unsigned int rowlen, unsigned int rows,
+        unsigned long px, unsigned int width) {
+    unsigned int i;
+
+    for(i=0;i<rows;i++)
+        bitshift_row(dst+i*stride, src+i*rowlen, rowlen, px, width);
+}
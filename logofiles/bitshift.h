@@ -0,0 +1,18 @@
+#ifndef __BITSHIFT_H
+#define __BITSHIFT_H
+
+/* Pixel offset windows of 1 bit per pixel bitmaps, leftmost pixel in the most
+ * significant bit like on the LCD. Rows wrap around, so scrolling past the
+ * right edge of the bitmap starts over at its left edge.
+ */
+
+// width bytes of a rowlen byte row, starting px pixels in
+void bitshift_row(unsigned char *dst, const unsigned char *row,
+        unsigned int rowlen, unsigned long px, unsigned int width);
+
+// the same for rows rows, stride bytes apart in dst and rowlen apart in src
+void bitshift_window(unsigned char *dst, unsigned int stride,
+        const unsigned char *src, unsigned int rowlen, unsigned int rows,
+        unsigned long px, unsigned int width);
+
+#endif
@@ -1,103 +1,284 @@
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "bmp.h"
+#include "dither.h"
 
 #define DEBUG 0
 
-unsigned char *bmp_loadfile(const char *filename, struct bmp_info *bmpinfo, char *err) {
-    int file;
-    unsigned char bmpdata[55];
+/* pixels darker than this are on when converting to 1 bit per pixel */
+#define BMP_THRESHOLD   128
+
+static unsigned int le16(const unsigned char *p) {
+    return p[0]|p[1]<<8;
+}
+
+static unsigned long le32(const unsigned char *p) {
+    return p[0]|p[1]<<8|p[2]<<16|(unsigned long)p[3]<<24;
+}
+
+static void le32_put(unsigned char *p, unsigned long v) {
+    p[0]=v;
+    p[1]=v>>8;
+    p[2]=v>>16;
+    p[3]=v>>24;
+}
+
+char bmp_open(const char *filename, struct bmp_image *img) {
+    const unsigned char *hdr;
     struct stat bmpstat;
-    int bmp_pad, bmprow_w;
-    unsigned char bmp_mask;
-    unsigned char *data;
-    int i;
+    unsigned long offset, hdrsize, rowbytes;
+    long height;
+    int file;
 
-    *err=0;
+    memset(img, 0, sizeof(*img));
 
     if((file=open(filename, O_RDONLY))<0) {
-        printf("could not open file");
-        *err=-1;
-        return 0;
+        printf("could not open file\n");
+        return -1;
     }
 
-    if(fstat(file, &bmpstat)<0) {
-        printf("stat of bmp file");
-        *err=-2;
-        return 0;
+    if(fstat(file, &bmpstat)<0 || bmpstat.st_size<54) {
+        printf("stat of bmp file\n");
+        close(file);
+        return -2;
     }
 
     if(DEBUG)
         printf("loading %li byte bitmap...\n", bmpstat.st_size);
 
-    if(read(file, bmpdata, sizeof(bmpdata))<0) {
-        printf("could not read bmp header");
-        *err=-3;
-        return 0;
+    // nothing is read or copied until the pixels are actually looked at
+    img->map=mmap(NULL, bmpstat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(img->map==MAP_FAILED) {
+        img->map=NULL;
+        printf("could not map bmp file\n");
+        return -3;
+    }
+    img->map_len=bmpstat.st_size;
+    hdr=img->map;
+
+    if(hdr[0]!='B' || hdr[1]!='M') {
+        printf("invalid bmp type\n");
+        bmp_close(img);
+        return -4;
     }
 
-    bmpinfo->type=bmpdata[0]<<8|bmpdata[1];
-    bmpinfo->fsize=bmpdata[5]<<24|bmpdata[4]<<16|bmpdata[3]<<8|bmpdata[2];
-    bmpinfo->zero1=bmpdata[6]<<8|bmpdata[7];
-    bmpinfo->zero2=bmpdata[8]<<8|bmpdata[9];
-    bmpinfo->offset=bmpdata[13]<<24|bmpdata[12]<<16|bmpdata[11]<<8|bmpdata[10];
+    offset=le32(hdr+10);
+    hdrsize=le32(hdr+14);
+    img->width=le32(hdr+18);
+    height=(int)le32(hdr+22);
+    img->bits=le16(hdr+28);
 
-    if(bmpinfo->type!=0x424d) {
-        printf("invalid bmp type");
-        *err=-4;
-        return 0;
+    // no RLE and no OS/2 headers
+    if(hdrsize<40 || le32(hdr+30)!=0 || !(img->bits==1 || img->bits==4 ||
+                img->bits==8 || img->bits==24 || img->bits==32)) {
+        printf("unsupported bmp format, %u bits per pixel\n", img->bits);
+        bmp_close(img);
+        return -5;
     }
 
-    // we don't care about the rest of the fields for now
-    bmpinfo->size=bmpdata[17]<<24|bmpdata[16]<<16|bmpdata[15]<<8|bmpdata[14];
-    bmpinfo->width=bmpdata[21]<<24|bmpdata[20]<<16|bmpdata[19]<<8|bmpdata[18];
-    bmpinfo->height=-1-(bmpdata[25]<<24|bmpdata[24]<<16|bmpdata[23]<<8|bmpdata[22])+1;
-    bmpinfo->bits=bmpdata[30]<<8|bmpdata[29];
+    // rows are padded to 4 bytes, negative height means top-down. Sizes are
+    // checked so nothing below can wrap around.
+    if(img->width>(UINT_MAX-31)/img->bits || height==INT_MIN) {
+        printf("bmp file is too big\n");
+        bmp_close(img);
+        return -6;
+    }
+    rowbytes=((img->width*img->bits+31)/32)*4;
+    img->height=height<0 ? -height : height;
+    if(offset>img->map_len || 
+            (img->height && rowbytes>(img->map_len-offset)/img->height)) {
+        printf("bmp file is truncated\n");
+        bmp_close(img);
+        return -6;
+    }
 
-    data=(unsigned char*)malloc(bmpstat.st_size);
-    if(data==NULL) {
-        printf("error: out of memory!\n");
-        *err=-5;
-        return 0;
+    if(img->bits<=8) {
+        img->colors=le32(hdr+46);
+        if(!img->colors || img->colors>(1u<<img->bits))
+            img->colors=1<<img->bits;
+        img->palette=hdr+14+hdrsize;
+        if(14+hdrsize+4*img->colors>offset) {
+            printf("bmp palette is truncated\n");
+            bmp_close(img);
+            return -6;
+        }
     }
 
-    if(lseek(file, bmpinfo->offset, SEEK_SET)<0) {
-        printf("could not seek bmp file");
-        *err=-6;
-        return 0;
+    if(height<0) {
+        img->rows=hdr+offset;
+        img->stride=rowbytes;
+    } else {
+        img->rows=hdr+offset+(img->height-1)*rowbytes;
+        img->stride=-(long)rowbytes;
     }
 
-    if(read(file, data, bmpstat.st_size)<0) {
-        printf("could not read bmp file");
-        *err=-7;
-        return 0;
+    return 0;
+}
+
+/* write packed 1 bpp rows, set bits dark, as a top-down bmp file */
+char bmp_save_mono(const char *filename, const unsigned char *rows,
+        unsigned int stride, unsigned int width, unsigned int height) {
+    unsigned char hdr[62], pad[4]={0, 0, 0, 0};
+    unsigned long rowbytes=((width+31)/32)*4, n=(width+7)/8;
+    unsigned int y;
+    FILE *file;
+
+    memset(hdr, 0x00, sizeof(hdr));
+    hdr[0]='B';
+    hdr[1]='M';
+    le32_put(hdr+2, sizeof(hdr)+rowbytes*height);
+    le32_put(hdr+10, sizeof(hdr));
+    le32_put(hdr+14, 40);
+    le32_put(hdr+18, width);
+    le32_put(hdr+22, -(long)height);
+    hdr[26]=1;
+    hdr[28]=1;
+    le32_put(hdr+46, 2);
+    // white then black, so set bits are dark
+    hdr[54]=hdr[55]=hdr[56]=0xff;
+
+    if(!(file=fopen(filename, "wb"))) {
+        printf("could not create file\n");
+        return -1;
+    }
+    fwrite(hdr, sizeof(hdr), 1, file);
+    for(y=0;y<height;y++) {
+        fwrite(rows+y*stride, n, 1, file);
+        fwrite(pad, rowbytes-n, 1, file);
+    }
+    if(fclose(file)) {
+        printf("could not write file\n");
+        return -2;
     }
+    return 0;
+}
 
-    // align bmp on 4 byte boundary and remove crap
-    bmp_pad=bmpinfo->width;
-    bmpinfo->width/=8;
-    bmprow_w=bmpinfo->width%4?bmpinfo->width+(4-(bmpinfo->width%4)):bmpinfo->width;
+void bmp_close(struct bmp_image *img) {
+    if(img->map)
+        munmap(img->map, img->map_len);
+    free(img->conv);
+    img->map=NULL;
+    img->conv=NULL;
+}
 
-    bmp_pad=(bmprow_w*8)-bmp_pad;
-    if(bmp_pad) {
-        for(i=0;i<bmp_pad;i++) {
-            bmp_mask<<=1;
-            bmp_mask|=0x01;
-        }
-        bmp_mask=~bmp_mask;
-        for(i=0;i<bmpinfo->height;i++) {
-            *(data+i*bmprow_w-1)&=bmp_mask;
+/* gray level of each palette entry */
+static void bmp_palette_gray(const struct bmp_image *img, unsigned char *lut) {
+    const unsigned char *c;
+    unsigned int i;
+
+    memset(lut, 0, 256);
+    for(i=0;i<img->colors;i++) {
+        c=img->palette+4*i;
+        lut[i]=(c[2]*77+c[1]*150+c[0]*29)>>8;
+    }
+}
+
+static void bmp_row_gray(const struct bmp_image *img, const unsigned char *lut,
+        const unsigned char *src, unsigned char *dst) {
+    unsigned int x, n;
+
+    switch(img->bits) {
+        case 1:
+            for(x=0;x<img->width;x++)
+                dst[x]=lut[(src[x/8]>>(7-x%8))&1];
+            break;
+        case 4:
+            for(x=0;x<img->width;x++)
+                dst[x]=lut[(src[x/2]>>(x%2 ? 0 : 4))&0x0f];
+            break;
+        case 8:
+            for(x=0;x<img->width;x++)
+                dst[x]=lut[src[x]];
+            break;
+        default:
+            // BGR or BGRx
+            n=img->bits/8;
+            for(x=0;x<img->width;x++,src+=n)
+                dst[x]=(src[2]*77+src[1]*150+src[0]*29)>>8;
+    }
+}
+
+void bmp_convert_mono(const struct bmp_image *img, unsigned char *dst,
+        unsigned int stride, unsigned char threshold) {
+    const unsigned char *src=img->rows;
+    unsigned int y, i, n=(img->width+7)/8;
+    unsigned char lut[256], t[8], *gray, invert=0;
+
+    bmp_palette_gray(img, lut);
+    if(img->bits==1) {
+        // only the palette decides which of the two colours is dark
+        invert=lut[0]<lut[1];
+        for(y=0;y<img->height;y++,src+=img->stride,dst+=stride) {
+            if(invert) {
+                for(i=0;i<n;i++)
+                    dst[i]=~src[i];
+            } else {
+                memcpy(dst, src, n);
+            }
+            if(img->width%8)
+                dst[n-1]&=0xff<<(8-img->width%8);
+            memset(dst+n, 0x00, stride-n);
         }
+        return;
     }
 
-    bmpinfo->width=bmprow_w;
+    memset(t, threshold, sizeof(t));
+    gray=(unsigned char*)malloc(img->width);
+    for(y=0;y<img->height;y++,src+=img->stride,dst+=stride) {
+        bmp_row_gray(img, lut, src, gray);
+        dither_pack(dst, gray, img->width, t);
+        memset(dst+n, 0x00, stride-n);
+    }
+    free(gray);
+}
+
+void bmp_convert_gray(const struct bmp_image *img, unsigned char *dst,
+        unsigned int stride) {
+    const unsigned char *src=img->rows;
+    unsigned char lut[256];
+    unsigned int y;
+
+    bmp_palette_gray(img, lut);
+    for(y=0;y<img->height;y++,src+=img->stride,dst+=stride) {
+        bmp_row_gray(img, lut, src, dst);
+        memset(dst+img->width, 0xff, stride-img->width);
+    }
+}
+
+const unsigned char *bmp_mono(struct bmp_image *img, unsigned int *stride) {
+    unsigned char lut[256];
+
+    // top-down 1 bit with a dark second colour is what the LCD takes as is,
+    // as long as the rows have no padding bytes or bits to mask
+    bmp_palette_gray(img, lut);
+    if(img->bits==1 && img->stride>0 && lut[1]<lut[0] && !(img->width%32)) {
+        *stride=img->stride;
+        return img->rows;
+    }
+
+    *stride=(img->width+7)/8;
+    free(img->conv);
+    img->conv=(unsigned char*)malloc(*stride*img->height);
+    if(!img->conv)
+        return NULL;
+    bmp_convert_mono(img, img->conv, *stride, BMP_THRESHOLD);
+    return img->conv;
+}
 
-    return data;
+const unsigned char *bmp_gray(struct bmp_image *img) {
+    free(img->conv);
+    img->conv=(unsigned char*)malloc(img->width*img->height);
+    if(!img->conv)
+        return NULL;
+    bmp_convert_gray(img, img->conv, img->width);
+    return img->conv;
 }
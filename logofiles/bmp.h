@@ -1,26 +1,45 @@
 #ifndef __BMP_H
 #define __BMP_H
 
-struct bmp_info {
-    unsigned int type;   // if it's 'BM' you're in luck
-    unsigned long fsize; // size of entire bmp file
-    unsigned int zero1;
-    unsigned int zero2;
-    unsigned long offset; // offset from start of file to start of data
-    unsigned long size; // size of bmp header info
-
-    unsigned long width;  // width in bytes, aligned to 4 bytes
-    unsigned long height; // height in bits
-    unsigned int  planes;
-    unsigned int  bits;
-    unsigned long compression;
-    unsigned long imagesize;
-    unsigned long xPxPerM;
-    unsigned long yPxPerM;
-    unsigned long colors;
-    unsigned long importantColors;
+#include <stddef.h>
+
+/* An uncompressed 1, 4, 8, 24 or 32 bit bmp file mapped into memory. rows
+ * points at the top row as the picture is shown, stride is how far the next
+ * row down is, negative for the usual bottom-up files.
+ */
+struct bmp_image {
+    unsigned int width;     // in pixels
+    unsigned int height;    // in pixels
+    unsigned int bits;      // bits per pixel in the file
+    const unsigned char *rows;
+    long stride;
+    const unsigned char *palette; // BGRx entries for 8 bits per pixel and less
+    unsigned int colors;
+
+    void *map;              // the whole file
+    size_t map_len;
+    unsigned char *conv;    // rows handed out by bmp_mono() and bmp_gray(),
+                            // good until the next call or bmp_close()
 };
 
-unsigned char *bmp_loadfile(const char *filename, struct bmp_info *bmpinfo, char *err);
+char bmp_open(const char *filename, struct bmp_image *img);
+void bmp_close(struct bmp_image *img);
+
+// packed 1 bit per pixel rows top down, set bits are dark pixels like on the
+// LCD. Points straight into the file when it's already stored that way.
+const unsigned char *bmp_mono(struct bmp_image *img, unsigned int *stride);
+
+// one byte per pixel top down, 0 is black and 255 white, width bytes a row
+const unsigned char *bmp_gray(struct bmp_image *img);
+
+// the same into a buffer of your own, rows stride bytes apart
+void bmp_convert_mono(const struct bmp_image *img, unsigned char *dst,
+        unsigned int stride, unsigned char threshold);
+void bmp_convert_gray(const struct bmp_image *img, unsigned char *dst,
+        unsigned int stride);
+
+// write packed 1 bit per pixel rows, set bits dark, to a new bmp file
+char bmp_save_mono(const char *filename, const unsigned char *rows,
+        unsigned int stride, unsigned int width, unsigned int height);
 
 #endif
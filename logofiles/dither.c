@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dither.h"
+
+static const unsigned char bayer[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+static unsigned char bitrev[256];
+
+static void dither_init(void) {
+    unsigned int i;
+
+    if(bitrev[1])
+        return;
+    for(i=0;i<256;i++)
+        bitrev[i]=(i*0x0202020202ULL & 0x010884422010ULL)%1023;
+}
+
+void dither_pack(unsigned char *dst, const unsigned char *gray,
+        unsigned int width, const unsigned char *t) {
+    unsigned int x=0, i;
+    unsigned char b;
+#ifdef __SSE2__
+    // there's only a signed compare, move both sides down by 128 first
+    __m128i bias=_mm_set1_epi8((char)0x80);
+    __m128i tv=_mm_xor_si128(_mm_set_epi8(t[7], t[6], t[5], t[4], t[3], t[2],
+                t[1], t[0], t[7], t[6], t[5], t[4], t[3], t[2], t[1], t[0]), bias);
+    __m128i v;
+    unsigned int m;
+
+    dither_init();
+    for(;x+16<=width;x+=16) {
+        v=_mm_xor_si128(_mm_loadu_si128((const __m128i*)(gray+x)), bias);
+        m=_mm_movemask_epi8(_mm_cmplt_epi8(v, tv));
+        // movemask puts the first pixel in the lowest bit, the LCD wants it
+        // in the highest
+        dst[x/8]=bitrev[m&0xff];
+        dst[x/8+1]=bitrev[m>>8];
+    }
+#endif
+    for(;x<width;x+=8) {
+        for(i=0,b=0;i<8;i++)
+            b=b<<1 | (x+i<width && gray[x+i]<t[i]);
+        dst[x/8]=b;
+    }
+}
+
+static void dither_ordered(unsigned char *dst, unsigned int dst_stride,
+        const unsigned char *src, unsigned int src_stride,
+        unsigned int width, unsigned int height, int method) {
+    unsigned char t[8][8];
+    unsigned int x, y;
+
+    // thresholds spread over 2..254 so black and white stay solid
+    for(y=0;y<8;y++)
+        for(x=0;x<8;x++)
+            t[y][x]=method==DITHER_BAYER ? bayer[y][x]*4+2 : 128;
+
+    for(y=0;y<height;y++)
+        dither_pack(dst+y*dst_stride, src+y*src_stride, width, t[y%8]);
+}
+
+/* Floyd-Steinberg, going back and forth so the errors don't all drift the
+ * same way. Errors are kept in sixteenths.
+ */
+static int dither_floyd(unsigned char *dst, unsigned int dst_stride,
+        const unsigned char *src, unsigned int src_stride,
+        unsigned int width, unsigned int height) {
+    int *err, *cur, *next, *swp;
+    int v, e, x, dir;
+    unsigned int i, y;
+
+    // one spare on each end so the neighbours never need checking
+    err=(int*)calloc(2*(width+2), sizeof(int));
+    if(!err)
+        return -1;
+    cur=err+1;
+    next=err+width+3;
+
+    for(y=0;y<height;y++,src+=src_stride,dst+=dst_stride) {
+        memset(next-1, 0, (width+2)*sizeof(int));
+        memset(dst, 0x00, (width+7)/8);
+        dir=y%2 ? -1 : 1;
+
+        for(i=0;i<width;i++) {
+            x=dir>0 ? (int)i : (int)(width-1-i);
+            v=src[x]+cur[x]/16;
+            if(v<128) {
+                dst[x/8]|=0x80>>(x%8);
+                e=v;
+            } else {
+                e=v-255;
+            }
+            cur[x+dir]+=7*e;
+            next[x-dir]+=3*e;
+            next[x]+=5*e;
+            next[x+dir]+=e;
+        }
+
+        swp=cur;
+        cur=next;
+        next=swp;
+    }
+
+    free(err);
+    return 0;
+}
+
+int dither_frame(unsigned char *dst, unsigned int dst_stride,
+        const unsigned char *src, unsigned int src_stride,
+        unsigned int width, unsigned int height, int method) {
+    unsigned int y, n=(width+7)/8;
+    int ret=0;
+
+    switch(method) {
+        case DITHER_NONE:
+        case DITHER_BAYER:
+            dither_ordered(dst, dst_stride, src, src_stride, width, height, method);
+            break;
+        case DITHER_FLOYD:
+            ret=dither_floyd(dst, dst_stride, src, src_stride, width, height);
+            break;
+        default:
+            return -1;
+    }
+
+    if(dst_stride>n) {
+        for(y=0;y<height;y++)
+            memset(dst+y*dst_stride+n, 0x00, dst_stride-n);
+    }
+    return ret;
+}
+
+int dither_method(const char *name) {
+    if(!strcmp(name, "none"))
+        return DITHER_NONE;
+    if(!strcmp(name, "bayer"))
+        return DITHER_BAYER;
+    if(!strcmp(name, "floyd"))
+        return DITHER_FLOYD;
+    return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef __DITHER_H
+#define __DITHER_H
+
+/* Gray to LCD conversion. Gray pixels are one byte each, 0 black to 255
+ * white, the output is packed 1 bit per pixel rows with set bits dark and the
+ * rest of each row up to its stride cleared, ready for T6963_WRITE_RECT.
+ */
+enum {
+    DITHER_NONE,        // plain threshold at the middle
+    DITHER_BAYER,       // ordered dither with an 8x8 Bayer matrix
+    DITHER_FLOYD,       // Floyd-Steinberg error diffusion
+};
+
+int dither_frame(unsigned char *dst, unsigned int dst_stride,
+        const unsigned char *src, unsigned int src_stride,
+        unsigned int width, unsigned int height, int method);
+
+// one row, pixels darker than t[x%8] are on
+void dither_pack(unsigned char *dst, const unsigned char *gray,
+        unsigned int width, const unsigned char *t);
+
+// name on the command line to DITHER_*, -1 if there's no such thing
+int dither_method(const char *name);
+
+#endif
@@ -25,7 +25,6 @@ void pixel_on(unsigned long at, unsigned char *buf) {
     *(buf+base_addr)|=mask;
 }
 
-// only takes 8 bit bitmaps right now
 // buffers should be 1/8 the size of orig and there should be num_buffers many of them
 void createBuffers(unsigned char *buffers, const unsigned char *orig, 
         unsigned int rowlen, unsigned int rows, unsigned char num_buffers) {
@@ -46,21 +45,22 @@ int main(int argc, char *argv[]) {
     int lcd;
     int i, j;
 
-    struct bmp_info bmpinfo;
+    struct bmp_image img;
     struct t6963_status lcd_status;
+    struct t6963_rect rect;
 
-    // buffer addresses in LCD memory
-    unsigned int *buffers;
+    // buffer addresses in LCD memory, cycled through by the driver
+    struct t6963_planes planes;
     unsigned int buf_addr;
 
     // bitmap buffers
     unsigned char *bmpdata;
+    unsigned int bmpwidth; // bytes per row of a buffer
     unsigned char *colorBuf;
     unsigned char *buf_ptr;
 
     char err;
-    unsigned int rowwid;
-    unsigned int addr;
+    unsigned int rowwid, plane_size=0;
     unsigned char num_buffers=6;
     unsigned long delay=10000;
 
@@ -86,9 +86,8 @@ int main(int argc, char *argv[]) {
             }
         }
     }
-
-    printf("displaying %s to screen with %d levels of grayscale, %.6f seconds "
-            "between refresh\n", argv[1], num_buffers, delay/1000000.0);
+    if(num_buffers>T6963_MAX_PLANES)
+        num_buffers=T6963_MAX_PLANES;
 
 #ifndef DUMP_BUFFERS
     if((lcd=open(lcd_path, O_RDWR))<0) {
@@ -99,23 +98,43 @@ int main(int argc, char *argv[]) {
     // poke the LCD
     ioctl(lcd, T6963_GET_STATUS, &lcd_status);
     ioctl(lcd, T6963_CLEAR_GRAPHICS, 0);
+
+    // as many whole screens as fit below the driver's glyph cache
+    plane_size=8*lcd_status.rows*lcd_status.row_width;
+    if(num_buffers>(lcd_status.graphics_end-lcd_status.graphics_base)/plane_size)
+        num_buffers=(lcd_status.graphics_end-lcd_status.graphics_base)/plane_size;
+    if(!num_buffers) {
+        printf("no room for a single plane\n");
+        exit(-1);
+    }
 #endif
 
+    printf("displaying %s to screen with %d levels of grayscale, %.6f seconds "
+            "between refresh\n", argv[1], num_buffers, delay/1000000.0);
+
     // load the bitmap
-    bmpdata=bmp_loadfile(argv[1], &bmpinfo, &err);
-    if(err<0) {
+    if((err=bmp_open(argv[1], &img))<0) {
         perror("could not load bmp file!");
         exit(-1);
     }
 
-    // set up buffer addresses on LCD
-    for(i=0;i<num_buffers;i++)
-        buffers[i]=lcd_status.graphics_base+(i*bmpinfo.width*bmpinfo.height);
+    // one gray byte per pixel, rows as many pixels as a buffer row has
+    bmpwidth=(img.width+7)/8;
+    bmpdata=(unsigned char*)malloc(8*bmpwidth*img.height);
+    bmp_convert_gray(&img, bmpdata, 8*bmpwidth);
+
+    // set up buffer addresses on LCD, a whole screen apart whatever the
+    // size of the bitmap
+    planes.count=num_buffers;
+    for(i=0;i<num_buffers;i++) {
+        planes.base[i]=lcd_status.graphics_base+i*plane_size;
+        planes.dwell_us[i]=delay;
+    }
     
     // init buffers
-    colorBuf=(unsigned char*)malloc(bmpinfo.width*bmpinfo.height*num_buffers);
-    memset(colorBuf, 0x00, bmpinfo.width*bmpinfo.height*num_buffers);
-    createBuffers(colorBuf, bmpdata, bmpinfo.width, bmpinfo.height, num_buffers);
+    colorBuf=(unsigned char*)malloc(bmpwidth*img.height*num_buffers);
+    memset(colorBuf, 0x00, bmpwidth*img.height*num_buffers);
+    createBuffers(colorBuf, bmpdata, bmpwidth, img.height, num_buffers);
 
 #ifdef DUMP_BUFFERS
     memset(dump_hdr, 0x00, 62);
@@ -139,7 +158,7 @@ int main(int argc, char *argv[]) {
         snprintf(buf_name, 8, "buffer%1d", i);
         buf_file=open(buf_name, O_RDWR | O_CREAT, 0);
         write(buf_file, dump_hdr, 62);
-        write(buf_file, colorBuf+(bmpinfo.width*bmpinfo.height*i), bmpinfo.width*bmpinfo.height);
+        write(buf_file, colorBuf+(bmpwidth*img.height*i), bmpwidth*img.height);
         close(buf_name);
     }
 
@@ -147,28 +166,28 @@ int main(int argc, char *argv[]) {
 #endif
 
     //clip to size of bmp
-    rowwid=bmpinfo.width<lcd_status.row_width?bmpinfo.width:lcd_status.row_width; 
+    rowwid=bmpwidth<lcd_status.row_width?bmpwidth:lcd_status.row_width; 
 
     // write buffers to display 
     for(j=0;j<num_buffers;j++) {
-        buf_ptr=colorBuf+(bmpinfo.width*bmpinfo.height*j);
-        buf_addr=*(buffers+j);
-
-        for(i=0;i<8*lcd_status.rows;i++) {
-            // jump from row to row
-            addr=(buf_addr)+(i*lcd_status.row_width);
-            ioctl(lcd, T6963_ADDR, &addr);
-           
-            write(lcd, buf_ptr+(i*bmpinfo.width), rowwid);
+        buf_ptr=colorBuf+(bmpwidth*img.height*j);
+        buf_addr=planes.base[j];
+
+        rect.addr=buf_addr;
+        rect.width=rowwid;
+        rect.height=img.height<8*lcd_status.rows ? img.height : 8*lcd_status.rows;
+        rect.stride=bmpwidth;
+        rect.data=buf_ptr;
+        if(ioctl(lcd, T6963_WRITE_RECT, &rect)<0) {
+            perror("could not write plane");
+            exit(-1);
         }
     }
 
-    
-    while(1) {
-        for(i=0;i<num_buffers;i++) {
-            ioctl(lcd, T6963_SET_GRAPHICS_BASE, buffers+i);
-            usleep(delay);
-        }
+    // the driver flips through the planes on its own from here on
+    if(ioctl(lcd, T6963_SET_PLANES, &planes)<0) {
+        perror("could not start cycling planes");
+        exit(-1);
     }
     
     return 0;
@@ -9,68 +9,42 @@
 
 #include "../t6963_commands.h"
 #include "bmp.h"
+#include "bitshift.h"
 
 #define DEBUG 0
 
 static char *lcd_path = "/dev/lcd";
 
-
-// takes a two dimensional array [7][bmp_size]
-// first dimension is 7 elements, each holding a second dimension with the bitmap
-// shifted by one pixel
-void precalc_bitshift(unsigned char *bits, const unsigned char *orig,
-        unsigned int rowlen, unsigned int rows) {
-    unsigned char mask=0, carry=0, loop=0;
-    int i,j,k;
-    unsigned char *cur;
-    const unsigned char *prev;
-
-    prev=orig;
-    cur=bits;
-
-    for(i=0;i<7;i++) {
-        mask|=0x80;
-        cur=bits+i*rowlen*rows;
-        
-        for(j=0;j<rows;j++) {
-            loop=((*(orig+j*rowlen))&mask)>>(7-i);
-
-            for(k=rowlen-1;k>=0;k--) {
-                carry=((*(orig+j*rowlen+k))&mask)>>(7-i);
-                *(cur+j*rowlen+k)=(*(orig+j*rowlen+k))<<(i+1);
-                *(cur+j*rowlen+k)|=loop;
-                loop=carry;
-            }
-        }
-        mask>>=1;
-    }
-    memcpy(bits+(7*rowlen*rows), orig, rowlen*rows);
-}
-
 int main(int argc, char *argv[]) {
     int lcd;
 
-    struct bmp_info bmpinfo;
+    struct bmp_image img;
 
-    unsigned char *bmpdata;
-    unsigned char *bmp;
-    unsigned char *bitshift;
+    const unsigned char *bmp;
+    unsigned int bmpwidth; // bytes per row
+    unsigned char *frame;
 
     struct t6963_status lcd_status;
+    struct t6963_rect rect;
+    struct t6963_viewport vp;
 
     unsigned int graphics_base_1, graphics_base_2;
     unsigned int *frame_ptr, *buf_ptr, *swp_ptr;
     unsigned char *clear;
-    unsigned int rowwid;
+    unsigned char *canvas;
+    unsigned int rowwid, canvas_width, canvas_base, col, maxwid;
 
-    int i, j, k, addr;
+    int i;
+    unsigned long px;
     char err;
 
-    unsigned char scroll=0;
+    unsigned char scroll=0, hwscroll=0;
     unsigned int delay=10000;
+    unsigned int rate;
 
     if(argc<2) {
-        printf("usage: %s filename [-s] [-d]\n\t-s\tscroll image"
+        printf("usage: %s filename [-s] [-b] [-d]\n\t-s\tscroll image"
+               "\n\t-b\tscroll a byte at a time by moving the viewport"
                "\n\t-d\tdelay between scroll updates in microseconds\n", argv[0]);
         exit(-1);
     }
@@ -79,6 +53,8 @@ int main(int argc, char *argv[]) {
         for(i=2;i<argc;i++) {
             if(argv[i][0] == '-' && argv[i][1] == 's')
                 scroll=1;
+            if(argv[i][0] == '-' && argv[i][1] == 'b')
+                hwscroll=1;
             if(argv[i][0] == '-' && argv[i][1] == 'd')
                 delay=atoi(argv[i+1]);
         }
@@ -109,58 +85,118 @@ int main(int argc, char *argv[]) {
 
     ioctl(lcd, T6963_ADDR, frame_ptr); //set address to graphics mem base
 
-    bmpdata=bmp_loadfile(argv[1], &bmpinfo, &err);
-    if(err<0) {
+    if((err=bmp_open(argv[1], &img))<0) {
         printf("could not load bmp file! %d\n", err);
         exit(-1);
     }
+    bmp=bmp_mono(&img, &bmpwidth);
+    if(img.height<8*lcd_status.rows) {
+        printf("bmp file needs to be at least %d rows high\n", 8*lcd_status.rows);
+        exit(-1);
+    }
 
     //clip to size of bmp
-    rowwid=bmpinfo.width<lcd_status.row_width?bmpinfo.width:lcd_status.row_width; 
+    rowwid=bmpwidth<lcd_status.row_width?bmpwidth:lcd_status.row_width; 
 
-    bmp=bmpdata;
+    rect.height=8*lcd_status.rows;
+    rect.stride=bmpwidth;
 
-    if(!scroll) {
-        for(i=0;i<8*lcd_status.rows;i++) 
-            write(lcd, bmp+(i*bmpinfo.width), rowwid);
+    if(!scroll && !hwscroll) {
+        rect.addr=*frame_ptr;
+        rect.width=rowwid;
+        rect.data=bmp;
+        ioctl(lcd, T6963_WRITE_RECT, &rect);
         exit(0);
     }
 
-    // allocate and fill single bit scrolling precalc buffer
-    bitshift=(unsigned char*)malloc(8*bmpinfo.height*bmpinfo.width);
-    precalc_bitshift(bitshift, bmp, bmpinfo.width, bmpinfo.height);
+    // one scroll step per frame
+    rate=delay?(1000000+delay-1)/delay:0;
+    ioctl(lcd, T6963_SET_FRAME_RATE, &rate);
+
+    if(hwscroll) {
+        // Graphics rows as wide as the driver has room for, or as the bitmap
+        // needs to come round to its start again. The viewport walks along
+        // them a byte a step and only the column about to come into view is
+        // uploaded. At the end of the canvas what's on screen is copied to
+        // its start and the viewport jumps back there, which only stays off
+        // screen if the canvas is at least two screens wide.
+        maxwid=(lcd_status.graphics_end-lcd_status.graphics_base)/
+            (8*lcd_status.rows);
+        if(maxwid>255)
+            maxwid=255;
+        canvas_width=bmpwidth+lcd_status.cols;
+        if(canvas_width<2*lcd_status.cols)
+            canvas_width=2*lcd_status.cols;
+        if(canvas_width>maxwid)
+            canvas_width=maxwid;
+        if(canvas_width<2*lcd_status.cols) {
+            printf("no room for a canvas two screens wide, scrolling in "
+                    "software\n");
+            hwscroll=0;
+        }
+    }
+
+    if(hwscroll) {
+        canvas_base=lcd_status.graphics_base;
+        canvas=(unsigned char*)malloc(lcd_status.cols*8*lcd_status.rows);
+        if(ioctl(lcd, T6963_SET_GRAPHICS_AREA, &canvas_width)<0) {
+            perror("could not set graphics area");
+            exit(-1);
+        }
 
-    bmp=bitshift;
-   
-    // let's get this thing rolling...
-    j=0;
-    while(1) {
-        for(k=0;k<8;k++) {
-            for(i=0;i<8*lcd_status.rows;i++) {
-                // jump from row to row
-                addr=*buf_ptr+(i*lcd_status.row_width);
-                ioctl(lcd, T6963_ADDR, &addr);
-               
-                // correct alignment on wraparound
-                if(j+rowwid>bmpinfo.width) {
-                    write(lcd, bmp+(i*bmpinfo.width)+j, bmpinfo.width-j);
-                    write(lcd, bmp+(i*bmpinfo.width), rowwid-(bmpinfo.width-j));
-                } else {
-                    write(lcd, bmp+(i*bmpinfo.width)+j, rowwid);
+        col=0;
+        vp.y=0;
+        while(1) {
+            // the screen, at the start of the canvas
+            bitshift_window(canvas, lcd_status.cols, bmp, bmpwidth, 
+                    8*lcd_status.rows, 8*col, lcd_status.cols);
+            rect.addr=canvas_base;
+            rect.width=lcd_status.cols;
+            rect.stride=lcd_status.cols;
+            rect.data=canvas;
+            ioctl(lcd, T6963_WRITE_RECT, &rect);
+
+            for(vp.x=0;vp.x<=canvas_width-lcd_status.cols;vp.x++) {
+                if(ioctl(lcd, T6963_SET_VIEWPORT, &vp)<0) {
+                    perror("could not move the viewport");
+                    exit(-1);
                 }
+                if(vp.x+lcd_status.cols>=canvas_width)
+                    break;
+
+                // the column coming into view on the next step
+                rect.addr=canvas_base+vp.x+lcd_status.cols;
+                rect.width=1;
+                rect.stride=bmpwidth;
+                rect.data=bmp+(col+vp.x+lcd_status.cols)%bmpwidth;
+                ioctl(lcd, T6963_WRITE_RECT, &rect);
             }
-            // swap framebuffers
-            swp_ptr=frame_ptr;
-            frame_ptr=buf_ptr;
-            buf_ptr=swp_ptr;
-            ioctl(lcd, T6963_SET_GRAPHICS_BASE, frame_ptr);
-            
-            // shift down one bit by selecting the next array
-            bmp=bitshift+(k*bmpinfo.width*bmpinfo.height);
-            usleep(delay);
+            col=(col+vp.x)%bmpwidth;
         }
-        // we've shifted a whole byte
-        j=(j+1)%bmpinfo.width;
+    }
+
+    // one row buffer, each step shifts the window out of the bitmap
+    frame=(unsigned char*)malloc(rowwid*8*lcd_status.rows);
+    rect.width=rowwid;
+    rect.stride=rowwid;
+    rect.data=frame;
+   
+    // let's get this thing rolling...
+    px=0;
+    while(1) {
+        bitshift_window(frame, rowwid, bmp, bmpwidth, 8*lcd_status.rows, 
+                px, rowwid);
+        rect.addr=*buf_ptr;
+        ioctl(lcd, T6963_WRITE_RECT, &rect);
+
+        // swap framebuffers, the driver flips on its next frame tick
+        // once the upload is out and holds off our next upload until then
+        swp_ptr=frame_ptr;
+        frame_ptr=buf_ptr;
+        buf_ptr=swp_ptr;
+        ioctl(lcd, T6963_QUEUE_FLIP, frame_ptr);
+
+        px=(px+1)%(8*bmpwidth);
     }
 
     return 0;
@@ -0,0 +1,124 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../t6963_commands.h"
+#include "bmp.h"
+#include "dither.h"
+
+static char *lcd_path = "/dev/lcd";
+
+static double now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int lcd;
+    int i;
+
+    struct bmp_image img;
+    struct t6963_status lcd_status;
+    struct t6963_rect rect;
+
+    const unsigned char *gray;
+    unsigned char *frame;
+    unsigned int width, height, stride;
+
+    char err;
+    char *out=NULL;
+    int method=DITHER_FLOYD;
+    int frames=0;
+    double start;
+
+    if(argc<2) {
+        printf("usage: %s filename [-m method] [-o file] [-t frames]"
+               "\n\t-m\tnone, bayer or floyd, default floyd"
+               "\n\t-o\twrite a 1 bit bmp file instead of showing it"
+               "\n\t-t\ttime converting it this many times\n", argv[0]);
+        exit(-1);
+    }
+
+    if(argc>2) {
+        for(i=2;i<argc-1;i++) {
+            if(argv[i][0]=='-' && argv[i][1]=='m') {
+                if((method=dither_method(argv[i+1]))<0) {
+                    printf("unknown dither method %s\n", argv[i+1]);
+                    exit(-1);
+                }
+            }
+            if(argv[i][0]=='-' && argv[i][1]=='o')
+                out=argv[i+1];
+            if(argv[i][0]=='-' && argv[i][1]=='t')
+                frames=atoi(argv[i+1]);
+        }
+    }
+
+    if((err=bmp_open(argv[1], &img))<0) {
+        printf("could not load bmp file! %d\n", err);
+        exit(-1);
+    }
+    if(!(gray=bmp_gray(&img))) {
+        printf("error: out of memory!\n");
+        exit(-1);
+    }
+
+    if(out || frames) {
+        // the whole picture, rows padded like in a bmp file
+        width=img.width;
+        height=img.height;
+        stride=((width+31)/32)*4;
+    } else {
+        if((lcd=open(lcd_path, O_RDWR))<0) {
+            perror("could not open LCD device");
+            exit(-1);
+        }
+        ioctl(lcd, T6963_GET_STATUS, &lcd_status);
+
+        // clip to the screen, rows padded to row_width like on the LCD
+        stride=lcd_status.row_width;
+        width=img.width<8*lcd_status.cols ? img.width : 8*lcd_status.cols;
+        height=img.height<8*lcd_status.rows ? img.height : 8*lcd_status.rows;
+    }
+
+    frame=(unsigned char*)malloc(stride*height);
+
+    if(frames) {
+        start=now();
+        for(i=0;i<frames;i++)
+            dither_frame(frame, stride, gray, img.width, width, height, method);
+        start=now()-start;
+        printf("%ux%u: %.3f ms a frame, %.0f frames per second\n", width, height,
+                start*1000/frames, frames/start);
+        if(!out)
+            return 0;
+    }
+
+    if(dither_frame(frame, stride, gray, img.width, width, height, method)<0) {
+        printf("could not convert image\n");
+        exit(-1);
+    }
+
+    if(out) {
+        if(bmp_save_mono(out, frame, stride, width, height)<0)
+            exit(-1);
+        return 0;
+    }
+
+    rect.addr=lcd_status.graphics_base;
+    rect.width=stride;
+    rect.height=height;
+    rect.stride=stride;
+    rect.data=frame;
+    ioctl(lcd, T6963_WRITE_RECT, &rect);
+
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../t6963_commands.h"
+#include "dither.h"
+
+/* Plays raw 8 bit gray video from stdin, e.g.
+ *
+ *   ffmpeg -i clip.avi -f rawvideo -pix_fmt gray -s 160x120 - | video -s 160x120
+ *
+ * Every stage runs on a thread of its own and hands frames to the next one
+ * through a small bounded queue, so reading, scaling, dithering and diffing
+ * all overlap with the upload and the parallel port is the only thing left
+ * to wait for. Frames that come out of the diff stage too late to be shown
+ * on time are dropped there, before they take up any bus time.
+ */
+
+#define DEBUG 0
+
+#define FRAMES  8       // frames in flight between all the stages
+#define QUEUE   FRAMES  // a queue never has to hold more than all of them
+
+static char *lcd_path = "/dev/lcd";
+
+struct frame {
+    unsigned long seq;
+    unsigned char *raw;     // as read, in_w x in_h
+    unsigned char *gray;    // scaled to the panel
+    unsigned char *mono;    // dithered, row_width bytes a row
+    unsigned int start;     // bytes of mono that changed since the last
+    unsigned int len;       // frame that went out
+};
+
+struct queue {
+    struct frame *f[QUEUE];
+    unsigned int head, tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void queue_init(struct queue *q) {
+    q->head=q->tail=0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+// NULL marks the end of the stream
+static void queue_put(struct queue *q, struct frame *f) {
+    pthread_mutex_lock(&q->lock);
+    while(q->head-q->tail>=QUEUE)
+        pthread_cond_wait(&q->cond, &q->lock);
+    q->f[q->head++%QUEUE]=f;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// frames waiting to be taken
+static unsigned int queue_len(struct queue *q) {
+    unsigned int n;
+
+    pthread_mutex_lock(&q->lock);
+    n=q->head-q->tail;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+static struct frame *queue_get(struct queue *q) {
+    struct frame *f;
+
+    pthread_mutex_lock(&q->lock);
+    while(q->head==q->tail)
+        pthread_cond_wait(&q->cond, &q->lock);
+    f=q->f[q->tail++%QUEUE];
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return f;
+}
+
+static struct queue q_free, q_scale, q_dither, q_diff, q_upload;
+
+static int lcd;
+static struct t6963_status lcd_status;
+static unsigned int in_w, in_h, out_w, out_h, rowwid;
+static int method=DITHER_BAYER;
+
+static unsigned int rate=25;
+static struct timespec t0;
+static unsigned long shown, dropped;
+
+static unsigned int *box_x, *box_y;   // first source pixel of each output one
+
+// when frame seq is due, in nanoseconds since t0
+static long long due(unsigned long seq) {
+    return (long long)seq*1000000000/rate;
+}
+
+static long long elapsed(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)(t.tv_sec-t0.tv_sec)*1000000000+(t.tv_nsec-t0.tv_nsec);
+}
+
+static void *reader(void *unused) {
+    struct frame *f;
+    unsigned long seq=0;
+    size_t size=in_w*in_h, got;
+    ssize_t n;
+
+    while(1) {
+        f=queue_get(&q_free);
+        for(got=0;got<size;got+=n) {
+            if((n=read(0, f->raw+got, size-got))<=0)
+                break;
+        }
+        if(got<size)
+            break;
+        // the clock starts with the first frame, the queues order the
+        // write before anyone else looks at it
+        if(!seq)
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+        f->seq=seq++;
+        queue_put(&q_scale, f);
+    }
+    queue_put(&q_scale, NULL);
+    return NULL;
+}
+
+/* box filter going down, nearest neighbour going up */
+static void *scaler(void *unused) {
+    struct frame *f;
+    unsigned int x, y, sx, sy, sum, n;
+
+    while((f=queue_get(&q_scale))) {
+        for(y=0;y<out_h;y++) {
+            for(x=0;x<out_w;x++) {
+                sum=n=0;
+                for(sy=box_y[y];sy<box_y[y+1] || sy==box_y[y];sy++) {
+                    for(sx=box_x[x];sx<box_x[x+1] || sx==box_x[x];sx++,n++)
+                        sum+=f->raw[sy*in_w+sx];
+                }
+                f->gray[y*out_w+x]=sum/n;
+            }
+        }
+        queue_put(&q_dither, f);
+    }
+    queue_put(&q_dither, NULL);
+    return NULL;
+}
+
+static void *ditherer(void *unused) {
+    struct frame *f;
+
+    while((f=queue_get(&q_dither))) {
+        dither_frame(f->mono, rowwid, f->gray, out_w, out_w, out_h, method);
+        queue_put(&q_diff, f);
+    }
+    queue_put(&q_diff, NULL);
+    return NULL;
+}
+
+/* Drops frames that are already late when there's a newer one right behind
+ * them, a late frame is still better than none if the input is what's slow.
+ *
+ * For the rest it finds the first and last byte that changed. The driver only
+ * sends the bytes that differ from what's on the LCD, so everything between
+ * them goes out with a single T6963_ADDR and write(), the unchanged bytes in
+ * between cost a copy but no bus time.
+ */
+static void *differ(void *unused) {
+    struct frame *f;
+    unsigned char *prev;
+    unsigned int size=rowwid*out_h, first, last;
+
+    prev=(unsigned char*)malloc(size);
+    memset(prev, 0x00, size);   // the LCD was cleared
+
+    while((f=queue_get(&q_diff))) {
+        if(elapsed()>due(f->seq+1) && queue_len(&q_diff)) {
+            dropped++;
+            queue_put(&q_free, f);
+            continue;
+        }
+
+        for(first=0;first<size && f->mono[first]==prev[first];first++)
+            ;
+        for(last=size;last>first && f->mono[last-1]==prev[last-1];last--)
+            ;
+        f->start=first;
+        f->len=last-first;
+        memcpy(prev+first, f->mono+first, f->len);
+        queue_put(&q_upload, f);
+    }
+    queue_put(&q_upload, NULL);
+    free(prev);
+    return NULL;
+}
+
+static void *uploader(void *unused) {
+    struct frame *f;
+    struct timespec t;
+    unsigned int addr;
+    long long ns;
+
+    while((f=queue_get(&q_upload))) {
+        // hold it until it's due
+        ns=due(f->seq)+t0.tv_nsec;
+        t.tv_sec=t0.tv_sec+ns/1000000000;
+        t.tv_nsec=ns%1000000000;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL))
+            ;
+
+        if(f->len) {
+            addr=lcd_status.graphics_base+f->start;
+            ioctl(lcd, T6963_ADDR, &addr);
+            if(write(lcd, f->mono+f->start, f->len)<0)
+                perror("write");
+        }
+        shown++;
+        queue_put(&q_free, f);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[5];
+    struct frame frames[FRAMES];
+    char *p;
+    int i;
+
+    for(i=1;i<argc-1;i++) {
+        if(argv[i][0]=='-' && argv[i][1]=='s') {
+            in_w=strtoul(argv[i+1], &p, 10);
+            if(*p=='x')
+                in_h=strtoul(p+1, NULL, 10);
+        }
+        if(argv[i][0]=='-' && argv[i][1]=='r')
+            rate=atoi(argv[i+1]);
+        if(argv[i][0]=='-' && argv[i][1]=='m') {
+            if((method=dither_method(argv[i+1]))<0) {
+                printf("unknown dither method %s\n", argv[i+1]);
+                exit(-1);
+            }
+        }
+    }
+    if(!in_w || !in_h || !rate) {
+        printf("usage: %s -s WxH [-r fps] [-m method] < raw 8 bit gray video"
+               "\n\t-s\tsize of the frames coming in"
+               "\n\t-r\tframes per second, default 25"
+               "\n\t-m\tnone, bayer or floyd, default bayer\n", argv[0]);
+        exit(-1);
+    }
+
+    if((lcd=open(lcd_path, O_RDWR))<0) {
+        perror("could not open LCD device");
+        exit(-1);
+    }
+    ioctl(lcd, T6963_GET_STATUS, &lcd_status);
+    ioctl(lcd, T6963_CLEAR_GRAPHICS, 0);
+
+    out_w=8*lcd_status.cols;
+    out_h=8*lcd_status.rows;
+    rowwid=lcd_status.row_width;
+
+    // where each output pixel's box starts in the source, plus one past the end
+    box_x=(unsigned int*)malloc((out_w+1)*sizeof(unsigned int));
+    box_y=(unsigned int*)malloc((out_h+1)*sizeof(unsigned int));
+    for(i=0;i<=out_w;i++)
+        box_x[i]=(unsigned long)i*in_w/out_w;
+    for(i=0;i<=out_h;i++)
+        box_y[i]=(unsigned long)i*in_h/out_h;
+
+    queue_init(&q_free);
+    queue_init(&q_scale);
+    queue_init(&q_dither);
+    queue_init(&q_diff);
+    queue_init(&q_upload);
+    for(i=0;i<FRAMES;i++) {
+        frames[i].raw=(unsigned char*)malloc(in_w*in_h);
+        frames[i].gray=(unsigned char*)malloc(out_w*out_h);
+        frames[i].mono=(unsigned char*)malloc(rowwid*out_h);
+        if(!frames[i].raw || !frames[i].gray || !frames[i].mono) {
+            printf("error: out of memory!\n");
+            exit(-1);
+        }
+        queue_put(&q_free, &frames[i]);
+    }
+
+    if(DEBUG)
+        printf("%ux%u to %ux%u at %u fps\n", in_w, in_h, out_w, out_h, rate);
+
+    pthread_create(&threads[0], NULL, reader, NULL);
+    pthread_create(&threads[1], NULL, scaler, NULL);
+    pthread_create(&threads[2], NULL, ditherer, NULL);
+    pthread_create(&threads[3], NULL, differ, NULL);
+    pthread_create(&threads[4], NULL, uploader, NULL);
+    for(i=0;i<5;i++)
+        pthread_join(threads[i], NULL);
+
+    fsync(lcd);
+    printf("%lu frames shown, %lu dropped\n", shown, dropped);
+    return 0;
+}
@@ -17,6 +17,7 @@
  *
  ******************************************************************************/
 
+#ifdef __KERNEL__
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -33,6 +34,13 @@
 #include <linux/config.h>
 #include <linux/version.h>
 #include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/moduleparam.h>
+#include <linux/delay.h>
+#else
+/* built into the userspace benchmark against the simulator */
+#include "bench/kcompat.h"
+#endif
 
 #include "t6963.h"
 #include "t6963_commands.h"
@@ -46,6 +54,9 @@ static spinlock_t lcd_lock = SPIN_LOCK_UNLOCKED;
 #define LCD_COLS        30
 #define LCD_SIZE        (LCD_ROWS*LCD_COLS)
 
+/* size of the display RAM on the board (8K on mine, the T6963C can address 64K) */
+#define LCD_RAM_SIZE    0x2000
+
 /* change your parallel port here */
 #define PORT_BASE       0x378
 #define DATA            (PORT_BASE)
@@ -83,23 +94,235 @@ static spinlock_t lcd_lock = SPIN_LOCK_UNLOCKED;
 #define LCD_DEBUG       0   // printk() debug messages
 
 /* I'm using non-delayed output for these macros. Put the bits on the wire, then
- * delay the necessary amount of time with a DELAY, rather than delaying for
- * each pin.
+ * delay the necessary amount of time with ndelay(), rather than delaying for
+ * each pin with outb_p() dummy writes, which take however long the chipset
+ * feels like.
+ *
+ * Bus timing in nanoseconds, one { setup, pulse, hold } triple per phase:
+ *   setup - C/D, R/W and data on the wire before CE goes active
+ *   pulse - CE active (for reads, until we sample the data lines)
+ *   hold  - after CE goes inactive before the next cycle may start
+ * The defaults are the T6963C data sheet minimums at 5V. If your cable is
+ * long or your board flaky, stretch them with e.g. lcd_data_timing=200,200,100
+ */
+#define T_SETUP         0
+#define T_PULSE         1
+#define T_HOLD          2
+
+static int lcd_cmd_timing[3] = { 100, 80, 40 };
+static int lcd_data_timing[3] = { 100, 80, 40 };
+static int lcd_status_timing[3] = { 100, 150, 50 };
+static int lcd_read_timing[3] = { 100, 150, 50 };
+module_param_array(lcd_cmd_timing, int, NULL, 0);
+module_param_array(lcd_data_timing, int, NULL, 0);
+module_param_array(lcd_status_timing, int, NULL, 0);
+module_param_array(lcd_read_timing, int, NULL, 0);
+
+#define LCD_DELAY(t,w)  lcd_delay((t)[w])
+
+/* rest of the control register: bit 5 turns the data lines around for
+ * reading, the high bits are what the old DATA_OUT left set
+ */
+#define CTRL_DATA_IN    0x20
+#define CTRL_DATA_OUT   0xd0
+
+/* the pinout can also be changed at load time */
+static int lcd_pin_read = CTRL_READ;
+static int lcd_pin_ce = CTRL_CE;
+static int lcd_pin_cmd = CTRL_CMD;
+static int lcd_pin_write = CTRL_WRITE;
+module_param(lcd_pin_read, int, 0);
+module_param(lcd_pin_ce, int, 0);
+module_param(lcd_pin_cmd, int, 0);
+module_param(lcd_pin_write, int, 0);
+
+/* Reading CTRL back before every pin change costs a slow ISA cycle each, so
+ * we remember what we last wrote and precompute the control byte for every
+ * phase of a bus cycle. Each phase is set up with CE off, then strobed by
+ * turning CE on, then the port goes back to idle.
+ */
+static u8 lcd_ctrl;             // last byte written to CTRL
+static u8 lcd_ctrl_idle;        // data lines driven, nothing selected
+static u8 lcd_ctrl_cmd_wr;      // command write
+static u8 lcd_ctrl_data_wr;     // data write
+static u8 lcd_ctrl_status_rd;   // status read
+static u8 lcd_ctrl_data_rd;     // data read
+static u8 lcd_ctrl_ce;
+
+/* Bus backends. Everything that touches the port goes through one of these,
+ * one function per bus phase. "pport" is the real parallel port, "sim" is an
+ * in-memory T6963C (t6963_sim.c) for trying things out without a panel.
  */
+struct lcd_bus_ops {
+    const char *name;
+    u8 (*status_rd)(void);
+    void (*cmd_wr)(u8 cmd);
+    void (*data_wr)(u8 data);
+    u8 (*data_rd)(void);
+    void (*delay)(unsigned int ns);
+};
+
+/* what the bus has cost us, kept by every backend */
+struct lcd_bus_stats {
+    unsigned long port_reads;
+    unsigned long port_writes;
+    unsigned long delay_ns;
+    unsigned long status_reads;
+    unsigned long cmds;
+    unsigned long data_writes;
+    unsigned long data_reads;
+};
+
+static struct lcd_bus_ops *lcd_bus;
+static struct lcd_bus_stats lcd_bus_stats;
+
+static char *lcd_bus_type = "pport";
+module_param(lcd_bus_type, charp, 0);
+
+static inline void lcd_delay(int ns) {
+    if(ns<=0)
+        return;
+    lcd_bus_stats.delay_ns+=ns;
+    lcd_bus->delay(ns);
+}
+
+static inline void lcd_ctrl_out(u8 ctrl) {
+    if(ctrl==lcd_ctrl)
+        return;
+    outb(ctrl, CTRL);
+    lcd_ctrl=ctrl;
+    lcd_bus_stats.port_writes++;
+}
+
+static void lcd_ctrl_init(void) {
+    lcd_ctrl_ce=lcd_pin_ce;
+    lcd_ctrl_idle=CTRL_DATA_OUT;
+    lcd_ctrl_cmd_wr=CTRL_DATA_OUT | lcd_pin_cmd | lcd_pin_write;
+    lcd_ctrl_data_wr=CTRL_DATA_OUT | lcd_pin_write;
+    lcd_ctrl_status_rd=CTRL_DATA_IN | lcd_pin_cmd | lcd_pin_read;
+    lcd_ctrl_data_rd=CTRL_DATA_IN | lcd_pin_read;
+
+    // don't trust whatever was on the port before us, the next cycle
+    // writes the whole register
+    lcd_ctrl=~lcd_ctrl_idle;
+}
+
+/* parallel port backend */
+
+static inline void lcd_pp_out(u8 data) {
+    outb(data, DATA);
+    lcd_bus_stats.port_writes++;
+}
+
+static inline u8 lcd_pp_in(void) {
+    lcd_bus_stats.port_reads++;
+    return inb(DATA);
+}
+
+static u8 lcd_pp_status_rd(void) {
+    u8 stat;
+
+    lcd_ctrl_out(lcd_ctrl_status_rd);
+    LCD_DELAY(lcd_status_timing, T_SETUP);
+    lcd_ctrl_out(lcd_ctrl_status_rd | lcd_ctrl_ce);
+    LCD_DELAY(lcd_status_timing, T_PULSE);
+
+    stat=lcd_pp_in();
+
+    lcd_ctrl_out(lcd_ctrl_idle);
+    LCD_DELAY(lcd_status_timing, T_HOLD);
+    return stat;
+}
+
+static void lcd_pp_cmd_wr(u8 cmd) {
+    lcd_pp_out(cmd);
+  
+    lcd_ctrl_out(lcd_ctrl_cmd_wr);
+    LCD_DELAY(lcd_cmd_timing, T_SETUP);
+    lcd_ctrl_out(lcd_ctrl_cmd_wr | lcd_ctrl_ce);
+    LCD_DELAY(lcd_cmd_timing, T_PULSE);
+  
+    lcd_ctrl_out(lcd_ctrl_idle);
+    LCD_DELAY(lcd_cmd_timing, T_HOLD);
+}
+
+static void lcd_pp_data_wr(u8 data) {
+    lcd_pp_out(data);
+
+    lcd_ctrl_out(lcd_ctrl_data_wr);
+    LCD_DELAY(lcd_data_timing, T_SETUP);
+    lcd_ctrl_out(lcd_ctrl_data_wr | lcd_ctrl_ce);
+    LCD_DELAY(lcd_data_timing, T_PULSE);
+
+    lcd_ctrl_out(lcd_ctrl_idle);
+    LCD_DELAY(lcd_data_timing, T_HOLD);
+}
+
+static u8 lcd_pp_data_rd(void) {
+    u8 data;
+
+    lcd_ctrl_out(lcd_ctrl_data_rd);
+    LCD_DELAY(lcd_read_timing, T_SETUP);
+
+    lcd_ctrl_out(lcd_ctrl_data_rd | lcd_ctrl_ce);
+    LCD_DELAY(lcd_read_timing, T_PULSE);
+
+    data=lcd_pp_in();
 
-#define LCD_DELAY       outb_p(0x00, 0x80)
+    lcd_ctrl_out(lcd_ctrl_idle);
+    LCD_DELAY(lcd_read_timing, T_HOLD);
+    return data;
+}
 
-#define READ_H          outb(inb(CTRL) | CTRL_READ, CTRL)
-#define READ_L          outb(inb(CTRL) & ~CTRL_READ, CTRL)
-#define CE_H            outb(inb(CTRL) | CTRL_CE, CTRL) 
-#define CE_L            outb(inb(CTRL) & ~CTRL_CE, CTRL)
-#define LCD_COMMAND     outb(inb(CTRL) | CTRL_CMD, CTRL)
-#define LCD_DATA        outb(inb(CTRL) & ~CTRL_CMD, CTRL)
-#define WRITE_H         outb(inb(CTRL) | CTRL_WRITE, CTRL)
-#define WRITE_L         outb(inb(CTRL) & ~CTRL_WRITE, CTRL)
-#define DATA_IN         outb(0x20, CTRL)
-#define DATA_OUT        outb(0xd0, CTRL)
+static void lcd_pp_delay(unsigned int ns) {
+    ndelay(ns);
+}
+
+static struct lcd_bus_ops lcd_pp_ops = {
+    .name =         "pport",
+    .status_rd =    lcd_pp_status_rd,
+    .cmd_wr =       lcd_pp_cmd_wr,
+    .data_wr =      lcd_pp_data_wr,
+    .data_rd =      lcd_pp_data_rd,
+    .delay =        lcd_pp_delay,
+};
+
+#include "t6963_sim.c"
+
+static void lcd_bus_init(void) {
+    if(!strcmp(lcd_bus_type, "sim")) {
+        lcd_bus=&lcd_sim_ops;
+        lcd_sim_reset();
+    } else {
+        lcd_bus=&lcd_pp_ops;
+    }
+    lcd_ctrl_init();
+
+    if(LCD_DEBUG)
+        printk("t6963: using %s bus\n", lcd_bus->name);
+}
+
+#ifdef __KERNEL__
+/* The graphics, framebuffer and console front ends each build their own copy
+ * of this file, with their own shadow and idea of the controller state, so
+ * only one of them can have the port. The simulator needs no claiming.
+ */
+static int lcd_claim_port(const char *name) {
+    if(!strcmp(lcd_bus_type, "sim"))
+        return 0;
+    if(!request_region(PORT_BASE, 3, name)) {
+        printk("t6963: port 0x%x is in use, is another T6963C driver loaded?\n",
+                PORT_BASE);
+        return -EBUSY;
+    }
+    return 0;
+}
 
+static void lcd_release_port(void) {
+    if(strcmp(lcd_bus_type, "sim"))
+        release_region(PORT_BASE, 3);
+}
+#endif
 
 /* state variables */
 static struct t6963_status lcd_stat;
@@ -117,6 +340,40 @@ static struct t6963_status lcd_stat;
 
 //u8 lcd_display_mode=0;
 
+/* Shadow copy of the display RAM. Every byte we put on the wire is recorded
+ * here, so writes only need to send the bytes that actually changed. A byte is
+ * only trusted once its bit in lcd_known is set; anything we haven't written
+ * (or that was written when a transfer failed) is treated as dirty.
+ */
+static u8 lcd_shadow[LCD_RAM_SIZE];
+static u8 lcd_known[LCD_RAM_SIZE/8];
+
+/* address the next write()/read() lands on, set with T6963_ADDR */
+static unsigned int lcd_addr_ptr;
+
+/* What the controller was last told, so commands that wouldn't change
+ * anything can be left out. -1 is unknown, which is where everything goes
+ * after a reset and whenever the LCD stops answering, since we can't tell
+ * what it got.
+ */
+static struct {
+    int addr;       // address pointer
+    int mode;       // CMD_MODESET bits
+    int display;    // CMD_DISPLAYMODE bits
+    int cursor;     // CMD_CURSOR_POS, x | y<<8
+} lcd_hw = { -1, -1, -1, -1 };
+
+static void lcd_hw_forget(void) {
+    lcd_hw.addr=-1;
+    lcd_hw.mode=-1;
+    lcd_hw.display=-1;
+    lcd_hw.cursor=-1;
+}
+
+/* 0 pushes every byte like the old driver did, handy to compare against */
+static int lcd_shadow_writes = 1;
+module_param(lcd_shadow_writes, int, 0);
+
 #define LCD_POS(x,y)    ((y)*(lcd_stat.lcd_num_col) + (x))
 
 static u8 lcd_status(void) {
@@ -125,16 +382,8 @@ static u8 lcd_status(void) {
 
     spin_lock_irqsave(&lcd_lock, flags);
 
-    DATA_IN;
-    LCD_COMMAND;
-    READ_H;
-    CE_H;
-    LCD_DELAY;
-
-    stat=inb_p(DATA);
-
-    DATA_OUT;
-    LCD_DELAY;
+    stat=lcd_bus->status_rd();
+    lcd_bus_stats.status_reads++;
 
     if(LCD_DEBUG>3)
         printk("t6963: status %02x\n", stat);
@@ -158,6 +407,7 @@ static char lcd_status_poll(void) {
     if(i==LCD_RETRY_LIM) {
         if(LCD_DEBUG)
             printk("t6963: status polling failed!\n");
+        lcd_hw_forget();
         return -1;
     }
 
@@ -175,6 +425,7 @@ static char lcd_aw_status_poll(void) {
     if(i==LCD_RETRY_LIM) {
         if(LCD_DEBUG)
             printk("t6963: auto write status polling failed!\n");
+        lcd_hw_forget();
         return -1;
     }
 
@@ -192,6 +443,7 @@ static char lcd_ar_status_poll(void) {
     if(i==LCD_RETRY_LIM) {
         if(LCD_DEBUG)
             printk("t6963: auto read status polling failed!\n");
+        lcd_hw_forget();
         return -1;
     }
 
@@ -205,20 +457,8 @@ static char lcd_cmd(u8 cmd) {
         return -1;
     
     spin_lock_irqsave(&lcd_lock, flags);
-    DATA_OUT;
-
-    outb_p(cmd, DATA);
-  
-    LCD_COMMAND;
-    WRITE_H;
-    CE_H;
-    LCD_DELAY;
-  
-    CE_L;
-    WRITE_L;
-    LCD_COMMAND;
-    LCD_DELAY;
-
+    lcd_bus->cmd_wr(cmd);
+    lcd_bus_stats.cmds++;
     spin_unlock_irqrestore(&lcd_lock, flags);
 
     return 0;
@@ -228,18 +468,8 @@ static void _lcd_write(u8 data) {
     unsigned long flags;
 
     spin_lock_irqsave(&lcd_lock, flags);
-    
-    outb_p(data, DATA);
-
-    DATA_OUT;
-    LCD_DATA;
-    WRITE_H;
-    CE_H;
-    LCD_DELAY;
-
-    DATA_OUT;
-    LCD_DELAY;
-
+    lcd_bus->data_wr(data);
+    lcd_bus_stats.data_writes++;
     spin_unlock_irqrestore(&lcd_lock, flags);
 }
 
@@ -250,14 +480,59 @@ static char lcd_write(u8 data) {
     return 0;
 }
 
+/* Burst mode: instead of polling STA3 before every auto write byte, only poll
+ * at the start of a burst and then check every lcd_burst_check bytes, with
+ * lcd_burst_gap ns of pacing between bytes in between. If a checkpoint finds
+ * the controller hasn't caught up, it isn't keeping up with our pacing and we
+ * go back to polling every byte until the next reset. 0 disables burst mode.
+ */
+static int lcd_burst_check = 0;
+static int lcd_burst_gap = 200;
+module_param(lcd_burst_check, int, 0);
+module_param(lcd_burst_gap, int, 0);
+
+static int lcd_burst_ok;        // cleared when a checkpoint fails
+static int lcd_burst_left;      // bytes until the next checkpoint, -1 at start
+
+/* what lcd_auto_write() did, or -1 if polling failed */
+#define LCD_AW_BLIND    0       // sent without looking at the status
+#define LCD_AW_CHECKED  1       // sent once the status said the LCD was ready
+#define LCD_AW_BEHIND   2       // a checkpoint found it behind, nothing sent
+
 static char lcd_auto_write(u8 data) {
-    if(lcd_aw_status_poll()) {
+    if(lcd_burst_left>0) {
+        lcd_burst_left--;
+        lcd_delay(lcd_burst_gap);
+        _lcd_write(data);
+        if(lcd_hw.addr>=0)
+            lcd_hw.addr++;
+        return LCD_AW_BLIND;
+    }
+
+    // checkpoint, a single status read has to show the LCD is ready
+    if(!lcd_burst_left && lcd_burst_check>0 && lcd_burst_ok) {
+        if(!(lcd_status() & STATUS_AUTO_WR)) {
+            printk("t6963: LCD fell behind in burst mode, polling every byte\n");
+            lcd_burst_ok=0;
+            return LCD_AW_BEHIND;
+        }
+    } else if(lcd_aw_status_poll()) {
         if(LCD_DEBUG)
             printk("---auto write status polling failed!\n");
         return -1;
     }
+    if(lcd_burst_check>0 && lcd_burst_ok)
+        lcd_burst_left=lcd_burst_check-1;
     _lcd_write(data);
-    return 0;
+    if(lcd_hw.addr>=0)
+        lcd_hw.addr++;
+    return LCD_AW_CHECKED;
+}
+
+/* enter auto write mode, the first byte always gets a full status poll */
+static char lcd_auto_write_start(void) {
+    lcd_burst_left=-1;
+    return lcd_cmd(CMD_AUTO_WRITE);
 }
 
 static u8 _lcd_read(void) {
@@ -265,21 +540,8 @@ static u8 _lcd_read(void) {
     unsigned long flags;
 
     spin_lock_irqsave(&lcd_lock, flags);
-
-    DATA_IN;
-    LCD_DELAY;
-
-    LCD_DATA;
-    READ_H;
-    CE_H;
-    LCD_DELAY;
-
-    data=inb(DATA);
-
-    CE_L;
-    READ_L;
-    LCD_COMMAND;
-
+    data=lcd_bus->data_rd();
+    lcd_bus_stats.data_reads++;
     spin_unlock_irqrestore(&lcd_lock, flags);
     return data;
 }
@@ -295,6 +557,8 @@ static u8 lcd_auto_read(u8 *data) {
     if(lcd_ar_status_poll())
         return 1;
     *data=_lcd_read();
+    if(lcd_hw.addr>=0)
+        lcd_hw.addr++;
     return 0;
 }
 
@@ -331,45 +595,75 @@ static char lcd_cmd_long(u16 data, u8 cmd) {
     return 0;
 }
 
-static void lcd_pos_cursor(int x, int y) {
-    lcd_cmd_d2(x,y,CMD_CURSOR_POS);
+/* the commands below only go out if they change something */
+static char lcd_set_addr(unsigned int addr) {
+    if(lcd_hw.addr==(int)addr)
+        return 0;
+    if(lcd_cmd_long(addr, CMD_ADDR_PTR)<0)
+        return -1;
+    lcd_hw.addr=addr;
+    return 0;
 }
 
-static char lcd_write_text(const u8 *data, int count) {
-    int i;
+static char lcd_set_mode(u8 mode) {
+    if(lcd_hw.mode==mode)
+        return 0;
+    if(lcd_cmd(CMD_MODESET | mode)<0)
+        return -1;
+    lcd_hw.mode=mode;
+    return 0;
+}
 
-    if(count<=0)
+static char lcd_update_display_mode(void) {
+    if(lcd_hw.display==lcd_stat.display_mode)
         return 0;
+    if(lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode)<0)
+        return -1;
+    lcd_hw.display=lcd_stat.display_mode;
+    return 0;
+}
 
-    if(LCD_DEBUG>2)
-        printk("t6963: auto text write \"");
-    lcd_cmd(CMD_AUTO_WRITE);
-    for(i=0;i<count;i++) {
-        if(LCD_DEBUG>2)
-            printk("%02x", *(data+i));
-        if(lcd_auto_write(*(data+i)-0x20)) 
-            return -1;
-    }
-    lcd_cmd(CMD_AUTO_RESET);
-    if(LCD_DEBUG>2)
-        printk("\"\n");
-    return i;
+static void lcd_pos_cursor(int x, int y) {
+    if(lcd_hw.cursor==(x | y<<8))
+        return;
+    if(lcd_cmd_d2(x,y,CMD_CURSOR_POS)==0)
+        lcd_hw.cursor=x | y<<8;
 }
 
-static char lcd_write_bytes(const u8 *data, int count) {
-    int i;
+static int lcd_write_bytes(const u8 *data, int count) {
+    int i, sure=0;      // the bytes before sure are known to be on the LCD
+    int addr;
 
     if(count<=0)
         return 0;
 
     if(LCD_DEBUG>2)
         printk("t6963: auto write \"");
-    lcd_cmd(CMD_AUTO_WRITE);
+    lcd_auto_write_start();
     for(i=0;i<count;i++) {
         if(LCD_DEBUG>2)
             printk("%02x", *(data+i));
-        if(lcd_auto_write(*(data+i))) 
-            return -1;
+        switch(lcd_auto_write(*(data+i))) {
+            case LCD_AW_CHECKED:
+                sure=i+1;
+                break;
+            case LCD_AW_BEHIND:
+                // what went out since the last checkpoint may have been
+                // dropped, send it again polling every byte
+                if(lcd_hw.addr<0)
+                    return -1;
+                addr=lcd_hw.addr-(i-sure);
+                lcd_hw.addr=-1;
+                if(lcd_cmd(CMD_AUTO_RESET)<0 || lcd_set_addr(addr)<0 ||
+                        lcd_auto_write_start()<0)
+                    return -1;
+                i=sure-1;
+                break;
+            case LCD_AW_BLIND:
+                break;
+            default:
+                return -1;
+        }
     }
     lcd_cmd(CMD_AUTO_RESET);
     if(LCD_DEBUG>2)
@@ -377,7 +671,7 @@ static char lcd_write_bytes(const u8 *data, int count) {
     return i;
 }
 
-static char lcd_read_bytes(u8 *data, int count) {
+static int lcd_read_bytes(u8 *data, int count) {
     int i;
 
     if(count<=0)
@@ -392,87 +686,797 @@ static char lcd_read_bytes(u8 *data, int count) {
     return i;
 }
 
-static char lcd_text_clear(void) {
-    int i;
-    // reset addr pointer
-    if(lcd_cmd_long(lcd_stat.text_base,CMD_ADDR_PTR)<0) 
+#define LCD_KNOWN(a)    (lcd_known[(a)>>3] & (1<<((a)&7)))
+#define LCD_MARKED(m,a) ((m)[(a)>>3] & (1<<((a)&7)))
+
+/* forget what we know about count bytes of display RAM starting at addr */
+static void lcd_shadow_forget(unsigned int addr, int count) {
+    for(;count>0 && addr<LCD_RAM_SIZE;count--,addr++)
+        lcd_known[addr>>3] &= ~(1<<(addr&7));
+}
+
+/* record that count bytes starting at addr now hold data on the LCD */
+static void lcd_shadow_update(unsigned int addr, const u8 *data, int count) {
+    if(addr>=LCD_RAM_SIZE)
+        return;
+    if(count>LCD_RAM_SIZE-addr)
+        count=LCD_RAM_SIZE-addr;
+
+    memcpy(lcd_shadow+addr, data, count);
+    for(;count>0;count--,addr++)
+        lcd_known[addr>>3] |= 1<<(addr&7);
+}
+
+/* Read count bytes of display RAM at addr. Whatever the shadow knows comes
+ * from there for the price of a memcpy, only the bytes it doesn't know are
+ * read from the LCD, and learned. hw reads everything from the LCD.
+ *
+ * returns count or -1 on failure
+ */
+static int lcd_read_shadow(unsigned int addr, u8 *data, int count, int hw) {
+    int i, j;
+
+    if(addr>=LCD_RAM_SIZE)
+        return -1;
+    if(count>LCD_RAM_SIZE-addr)
+        count=LCD_RAM_SIZE-addr;
+
+    for(i=0;i<count;i=j) {
+        if(!hw && LCD_KNOWN(addr+i)) {
+            for(j=i+1;j<count && LCD_KNOWN(addr+j);j++)
+                ;
+            memcpy(data+i, lcd_shadow+addr+i, j-i);
+            continue;
+        }
+
+        for(j=i+1;j<count && (hw || !LCD_KNOWN(addr+j));j++)
+            ;
+        if(lcd_set_addr(addr+i)<0 || lcd_read_bytes(data+i, j-i)!=j-i)
+            return -1;
+        lcd_shadow_update(addr+i, data+i, j-i);
+    }
+    return count;
+}
+
+/* address one run and auto write it, keeping the shadow in sync */
+static int lcd_write_run(unsigned int addr, const u8 *data, int count) {
+    if(lcd_set_addr(addr)<0 || lcd_write_bytes(data, count)!=count) {
+        lcd_shadow_forget(addr, count);
         return -1;
+    }
+    lcd_shadow_update(addr, data, count);
+    return 0;
+}
 
-    // clear screen
-    if(lcd_cmd(CMD_AUTO_WRITE)<0)
+/* a data byte with CMD_WRITE_INCR, no auto mode to get in and out of */
+static char lcd_write_incr(u8 data) {
+    if(lcd_write(data)<0 || lcd_cmd(CMD_WRITE_INCR)<0)
         return -1;
-    for(i=lcd_stat.text_base;i<lcd_stat.graphics_base;i++) {
-        if(lcd_auto_write(0x00)<0)
+    if(lcd_hw.addr>=0)
+        lcd_hw.addr++;
+    return 0;
+}
+
+/* Transfer planner. Changed bytes can go out in three ways, each after a
+ * CMD_ADDR_PTR unless the pointer is already there:
+ *
+ *   auto write     AUTO_WRITE, a polled data byte each, AUTO_RESET
+ *   single write   a data byte and CMD_WRITE_INCR each, nothing around them
+ *   bit set        a CMD_BIT_SET for every pixel that changed, the pointer
+ *                  stays where it is
+ *
+ * Writes may also run over bytes that didn't change when that's cheaper than
+ * moving the pointer. lcd_plan_write() picks the cheapest mix under lcd_cost,
+ * what one status poll, command byte and data byte take on this board in ns.
+ * The defaults are four port accesses of about 1us on an ISA parallel port
+ * plus the bus timing above.
+ */
+static int lcd_cost[3] = { 4300, 4220, 4220 };
+module_param_array(lcd_cost, int, NULL, 0);
+
+#define COST_POLL       0
+#define COST_CMD        1
+#define COST_DATA       2
+
+/* 0 sends every changed run as an auto write like before the planner */
+static int lcd_plan = 1;
+module_param(lcd_plan, int, 0);
+
+#define LCD_PLAN_MAX    512         // changed bytes planned at once
+#define LCD_PLAN_NONE   0x3fffffffL
+
+enum {
+    LCD_OP_AUTO,
+    LCD_OP_SINGLE,
+    LCD_OP_BITS,
+};
+
+struct lcd_plan_step {
+    long cost;
+    u8 op;
+    u16 from;       // changed byte the op starts at
+};
+
+/* step[k][1] has the first k changed bytes done with the pointer right after
+ * the last one, step[k][0] with the pointer still on it after a bit set
+ */
+static u16 lcd_plan_pos[LCD_PLAN_MAX];
+static struct lcd_plan_step lcd_plan_step[LCD_PLAN_MAX+1][2];
+static u8 lcd_plan_via[LCD_PLAN_MAX];       // step the cheapest start at k is from
+static u16 lcd_plan_ops[LCD_PLAN_MAX];      // the plan, last op first
+
+static int lcd_bits_changed(u8 diff) {
+    int n;
+
+    for(n=0;diff;diff&=diff-1)
+        n++;
+    return n;
+}
+
+static int lcd_plan_op(unsigned int addr, const u8 *data, int op, int first,
+        int last) {
+    unsigned int i;
+    u8 diff;
+
+    if(LCD_DEBUG>1)
+        printk("t6963: op %d 0x%04x-0x%04x\n", op, addr+first, addr+last+1);
+
+    if(lcd_set_addr(addr+first)<0)
+        goto fail;
+    switch(op) {
+        case LCD_OP_AUTO:
+            if(lcd_write_bytes(data+first, last-first+1)!=last-first+1)
+                goto fail;
+            break;
+        case LCD_OP_SINGLE:
+            for(i=first;i<=last;i++) {
+                if(lcd_write_incr(data[i])<0)
+                    goto fail;
+            }
+            break;
+        case LCD_OP_BITS:
+            diff=lcd_shadow[addr+first]^data[first];
+            for(i=0;i<8;i++) {
+                if(!(diff & (1<<i)))
+                    continue;
+                if(lcd_cmd(CMD_BIT_SET | (data[first] & (1<<i) ? BIT_SET : BIT_RESET)
+                            | i)<0)
+                    goto fail;
+            }
+            break;
+    }
+    lcd_shadow_update(addr+first, data+first, last-first+1);
+    return 0;
+
+fail:
+    lcd_shadow_forget(addr+first, last-first+1);
+    return -1;
+}
+
+/* find and send the cheapest way to write the n changed bytes of data at the
+ * offsets in lcd_plan_pos. Every op covers a stretch of changed bytes and
+ * costs a fixed part plus a part per byte, so for each changed byte it's
+ * enough to remember the cheapest place to have started an auto or single
+ * write run that reaches it.
+ */
+static int lcd_plan_write(unsigned int addr, const u8 *data, int n) {
+    struct lcd_plan_step (*step)[2]=lcd_plan_step;
+    u16 *pos=lcd_plan_pos;
+    long addr_cost, single, bit, auto_fix, auto_byte;
+    long start, best_auto, best_single, c;
+    int from_auto=0, from_single=0, k, j, t, nops;
+
+    addr_cost=3*lcd_cost[COST_POLL]+2*lcd_cost[COST_DATA]+lcd_cost[COST_CMD];
+    single=2*lcd_cost[COST_POLL]+lcd_cost[COST_DATA]+lcd_cost[COST_CMD];
+    bit=lcd_cost[COST_POLL]+lcd_cost[COST_CMD];
+    auto_fix=2*bit;
+    auto_byte=lcd_cost[COST_POLL]+lcd_cost[COST_DATA];
+    if(lcd_burst_check>0 && lcd_burst_ok)
+        auto_byte=lcd_cost[COST_DATA]+lcd_burst_gap+
+            lcd_cost[COST_POLL]/lcd_burst_check;
+
+    best_auto=best_single=LCD_PLAN_NONE;
+    for(k=0;k<n;k++) {
+        if(!k) {
+            start=lcd_hw.addr==(int)(addr+pos[0]) ? 0 : addr_cost;
+            lcd_plan_via[k]=1;
+        } else {
+            start=step[k][1].cost+(pos[k]==pos[k-1]+1 ? 0 : addr_cost);
+            lcd_plan_via[k]=1;
+            if(step[k][0].cost+addr_cost<start) {
+                start=step[k][0].cost+addr_cost;
+                lcd_plan_via[k]=0;
+            }
+        }
+
+        if(start-pos[k]*auto_byte<best_auto) {
+            best_auto=start-pos[k]*auto_byte;
+            from_auto=k;
+        }
+        if(start-pos[k]*single<best_single) {
+            best_single=start-pos[k]*single;
+            from_single=k;
+        }
+
+        c=best_auto+auto_fix+(pos[k]+1)*auto_byte;
+        step[k+1][1].cost=c;
+        step[k+1][1].op=LCD_OP_AUTO;
+        step[k+1][1].from=from_auto;
+        c=best_single+(pos[k]+1)*single;
+        if(c<step[k+1][1].cost) {
+            step[k+1][1].cost=c;
+            step[k+1][1].op=LCD_OP_SINGLE;
+            step[k+1][1].from=from_single;
+        }
+
+        // bits can only be flipped if we know what's there
+        step[k+1][0].cost=LCD_PLAN_NONE;
+        if(LCD_KNOWN(addr+pos[k])) {
+            step[k+1][0].cost=start+
+                bit*lcd_bits_changed(lcd_shadow[addr+pos[k]]^data[pos[k]]);
+            step[k+1][0].op=LCD_OP_BITS;
+            step[k+1][0].from=k;
+        }
+    }
+
+    // walk back from the end, then send it front to back
+    nops=0;
+    t=step[n][0].cost<step[n][1].cost ? 0 : 1;
+    for(k=n;k>0;k=j) {
+        j=step[k][t].from;
+        lcd_plan_ops[nops++]=k<<1 | t;
+        t=lcd_plan_via[j];
+    }
+    for(j=0;nops>0;j=k) {
+        nops--;
+        k=lcd_plan_ops[nops]>>1;
+        t=lcd_plan_ops[nops]&1;
+        if(lcd_plan_op(addr, data, step[k][t].op, pos[j], pos[k-1])<0)
             return -1;
     }
+    return 0;
+}
 
-    printk("t6963: text memory from 0x%04x to 0x%04x cleared.\n", 
-            lcd_stat.text_base, lcd_stat.text_base+i);
+/* Write count bytes of data to display RAM at addr, but only put the bytes
+ * that differ from the shadow copy on the wire, the way lcd_plan_write()
+ * finds cheapest.
+ *
+ * returns count or -1 on failure
+ */
+static int lcd_write_diff(unsigned int addr, const u8 *data, int count) {
+    int i, start, n;
 
-    if(lcd_cmd(CMD_AUTO_RESET)<0)
+    if(count<=0)
+        return 0;
+    if(addr>=LCD_RAM_SIZE)
+        return -1;
+    if(count>LCD_RAM_SIZE-addr)
+        count=LCD_RAM_SIZE-addr;
+
+    if(!lcd_shadow_writes)
+        return lcd_write_run(addr, data, count)<0 ? -1 : count;
+
+    if(lcd_plan) {
+        for(i=0,n=0;i<count;i++) {
+            if(LCD_KNOWN(addr+i) && lcd_shadow[addr+i]==data[i])
+                continue;
+            lcd_plan_pos[n++]=i;
+            if(n==LCD_PLAN_MAX) {
+                if(lcd_plan_write(addr, data, n)<0)
+                    return -1;
+                n=0;
+            }
+        }
+        if(n && lcd_plan_write(addr, data, n)<0)
+            return -1;
+        return count;
+    }
+
+    i=0;
+    while(i<count) {
+        // skip over bytes the LCD already has
+        while(i<count && LCD_KNOWN(addr+i) && lcd_shadow[addr+i]==data[i])
+            i++;
+        if(i==count)
+            break;
+
+        start=i;
+        while(i<count && !(LCD_KNOWN(addr+i) && lcd_shadow[addr+i]==data[i]))
+            i++;
+
+        if(LCD_DEBUG>1)
+            printk("t6963: dirty run 0x%04x-0x%04x\n", addr+start, addr+i);
+        if(lcd_write_run(addr+start, data+start, i-start)<0)
+            return -1;
+    }
+
+    return count;
+}
+
+/* lcd_write_diff() for the bytes from first up to end of ram, an image of all
+ * of display RAM, that have their bit set in mark. The others aren't looked
+ * at, though the planner may still send some of them along to save moving
+ * the pointer.
+ *
+ * returns 0 or -1 on failure
+ */
+static int lcd_write_marked(const u8 *ram, const u8 *mark, unsigned int first,
+        unsigned int end) {
+    unsigned int a, start;
+    int n=0;
+
+    if(end>LCD_RAM_SIZE)
+        end=LCD_RAM_SIZE;
+
+    if(!lcd_plan || !lcd_shadow_writes) {
+        for(a=first;a<end;) {
+            for(;a<end && !LCD_MARKED(mark, a);a++)
+                ;
+            for(start=a;a<end && LCD_MARKED(mark, a);a++)
+                ;
+            if(a>start && lcd_write_diff(start, ram+start, a-start)<0)
+                return -1;
+        }
+        return 0;
+    }
+
+    for(a=first;a<end;a++) {
+        if(!LCD_MARKED(mark, a) || (LCD_KNOWN(a) && lcd_shadow[a]==ram[a]))
+            continue;
+        // the planner takes offsets from where this batch starts
+        if(!n)
+            start=a;
+        lcd_plan_pos[n++]=a-start;
+        if(n==LCD_PLAN_MAX) {
+            if(lcd_plan_write(start, ram+start, n)<0)
+                return -1;
+            n=0;
+        }
+    }
+    if(n && lcd_plan_write(start, ram+start, n)<0)
         return -1;
     return 0;
 }
 
-static char lcd_graphics_clear(void) {
+/* where the text area starts, CMD_TEXT_HOME_ADDR goes through here */
+static unsigned int lcd_text_home;
+
+static char lcd_set_text_home(unsigned int addr) {
+    lcd_text_home=addr;
+    return lcd_cmd_long(addr-2, CMD_TEXT_HOME_ADDR);
+}
+
+/* CG RAM as a glyph cache. With the ROM character generator selected the
+ * T6963C still takes codes 0x80-0xff from CG RAM, 8 bytes each at
+ * (offset<<11)+code*8, so a glyph the ROM doesn't have is uploaded once and
+ * then costs one byte a character like any other. Glyphs are defined with
+ * T6963_DEFINE_GLYPH and get a slot the first time they're written. Once all
+ * 128 slots are taken the one written longest ago goes, unless it's on screen.
+ */
+static int lcd_cg_offset = 3;   // 2K block of CG RAM, 3 puts the glyphs at 0x1c00
+module_param(lcd_cg_offset, int, 0);
+
+#define LCD_CG_FIRST        0x80
+#define LCD_CG_SLOTS        0x80
+#define LCD_CG_ADDR(code)   ((lcd_cg_offset<<11)+(code)*8)
+
+#define LCD_GLYPHS          256
+#define LCD_GLYPH_HASH_BITS 9   // twice as many buckets as glyphs
+#define LCD_GLYPH_HASH      (1<<LCD_GLYPH_HASH_BITS)
+
+#define LCD_CODE_UNKNOWN    ('?'-0x20)
+
+struct lcd_glyph {
+    u32 code;       // Unicode code point
+    u8 bits[8];
+    int slot;       // where it is in CG RAM, -1 if it isn't
+};
+
+static struct lcd_glyph lcd_glyphs[LCD_GLYPHS];
+static int lcd_glyph_count;
+static short lcd_glyph_hash[LCD_GLYPH_HASH];    // glyph+1, 0 if empty
+
+static short lcd_cg_glyph[LCD_CG_SLOTS];        // glyph in each slot
+static unsigned long lcd_cg_used[LCD_CG_SLOTS]; // lcd_cg_clock when last written
+static unsigned long lcd_cg_clock;
+static int lcd_cg_fill;                         // slots below this are taken
+static unsigned int lcd_cg_over, lcd_cg_over_end;   // text about to be replaced
+
+/* what each byte of text turns into with the ASCII and user charsets, a ROM
+ * code if it's >=0, glyph -(n+1) if not. UTF-8 uses it below 0x80.
+ */
+static int lcd_charset = T6963_CHARSET_ASCII;
+static u32 lcd_charset_map[256];
+static short lcd_byte_code[256];
+
+static inline unsigned int lcd_glyph_bucket(u32 code) {
+    return (code*2654435761U)>>(32-LCD_GLYPH_HASH_BITS);
+}
+
+static int lcd_glyph_find(u32 code) {
+    unsigned int h;
+
+    for(h=lcd_glyph_bucket(code);lcd_glyph_hash[h];h=(h+1)%LCD_GLYPH_HASH) {
+        if(lcd_glyphs[lcd_glyph_hash[h]-1].code==code)
+            return lcd_glyph_hash[h]-1;
+    }
+    return -1;
+}
+
+/* a code point to a ROM code or a glyph, like lcd_byte_code */
+static short lcd_map_code(u32 code) {
+    int g;
+
+    if(lcd_glyph_count && (g=lcd_glyph_find(code))>=0)
+        return -(g+1);
+    if(code>=0x20 && code<0x80)
+        return code-0x20;
+    return LCD_CODE_UNKNOWN;
+}
+
+static void lcd_charset_update(void) {
+    int i;
+    u32 code;
+
+    for(i=0;i<256;i++) {
+        code=lcd_charset==T6963_CHARSET_USER ? lcd_charset_map[i] : i;
+        if(code & T6963_CHARSET_ROM) {
+            lcd_byte_code[i]=code & 0x7f;
+            continue;
+        }
+        lcd_byte_code[i]=lcd_map_code(code);
+
+        // bytes 0x80-0x9f have always been the ROM's extended characters
+        if(lcd_charset==T6963_CHARSET_ASCII && i>=0x80 && i<0xa0 &&
+                lcd_byte_code[i]==LCD_CODE_UNKNOWN)
+            lcd_byte_code[i]=i-0x20;
+    }
+}
+
+/* CG RAM is gone after a reset, the glyphs stay defined */
+static char lcd_cg_reset(void) {
     int i;
-    // reset addr pointer
-    if(lcd_cmd_long(lcd_stat.graphics_base,CMD_ADDR_PTR)<0) 
+
+    // the glyphs go above graphics memory, which needs room for two screens
+    if(LCD_CG_ADDR(0x100)>LCD_RAM_SIZE || LCD_CG_ADDR(LCD_CG_FIRST)<
+            lcd_stat.graphics_base+2*8*lcd_stat.row_width*lcd_stat.rows)
+        lcd_cg_offset=(LCD_RAM_SIZE>>11)-1;
+    lcd_stat.graphics_end=LCD_CG_ADDR(LCD_CG_FIRST);
+    for(i=0;i<lcd_glyph_count;i++)
+        lcd_glyphs[i].slot=-1;
+    for(i=0;i<LCD_CG_SLOTS;i++)
+        lcd_cg_glyph[i]=-1;
+    lcd_cg_fill=0;
+    lcd_charset_update();
+    return lcd_cmd_d2(lcd_cg_offset, 0x00, CMD_OFFSET_REG);
+}
+
+/* the slot written longest ago that isn't on screen or going there with the
+ * text being written now, -1 if there's none. What that text overwrites
+ * doesn't count as on screen.
+ */
+static int lcd_cg_victim(void) {
+    u8 shown[LCD_CG_SLOTS/8];
+    unsigned int a, end;
+    int slot, best=-1;
+
+    if(lcd_cg_fill<LCD_CG_SLOTS)
+        return lcd_cg_fill++;
+
+    memset(shown, 0x00, sizeof(shown));
+    end=lcd_text_home+lcd_stat.rows*lcd_stat.cols;
+    if(end>LCD_RAM_SIZE)
+        end=LCD_RAM_SIZE;
+    for(a=lcd_text_home;a<end;a++) {
+        if(a>=lcd_cg_over && a<lcd_cg_over_end)
+            continue;
+        if(LCD_KNOWN(a) && lcd_shadow[a]>=LCD_CG_FIRST) {
+            slot=lcd_shadow[a]-LCD_CG_FIRST;
+            shown[slot>>3]|=1<<(slot&7);
+        }
+    }
+
+    for(slot=0;slot<LCD_CG_SLOTS;slot++) {
+        if(shown[slot>>3] & (1<<(slot&7)) || lcd_cg_used[slot]==lcd_cg_clock)
+            continue;
+        if(best<0 || lcd_cg_used[slot]<lcd_cg_used[best])
+            best=slot;
+    }
+    return best;
+}
+
+/* the character code for glyph g, uploading it first if it isn't in CG RAM */
+static u8 lcd_glyph_code(int g) {
+    struct lcd_glyph *glyph=&lcd_glyphs[g];
+    int slot=glyph->slot;
+
+    if(slot<0) {
+        if((slot=lcd_cg_victim())<0)
+            return LCD_CODE_UNKNOWN;
+        if(lcd_cg_glyph[slot]>=0)
+            lcd_glyphs[lcd_cg_glyph[slot]].slot=-1;
+        lcd_cg_glyph[slot]=-1;
+        if(lcd_write_diff(LCD_CG_ADDR(LCD_CG_FIRST+slot), glyph->bits, 8)<0)
+            return LCD_CODE_UNKNOWN;
+        lcd_cg_glyph[slot]=g;
+        glyph->slot=slot;
+    }
+    lcd_cg_used[slot]=lcd_cg_clock;
+    return LCD_CG_FIRST+slot;
+}
+
+/* add or change a glyph, one already in CG RAM is updated right away
+ *
+ * returns 0 or -1 if there's no room for another one
+ */
+static char lcd_define_glyph(u32 code, const u8 *bits) {
+    struct lcd_glyph *glyph;
+    unsigned int h;
+    int g;
+
+    if((g=lcd_glyph_find(code))>=0) {
+        glyph=&lcd_glyphs[g];
+        memcpy(glyph->bits, bits, 8);
+        if(glyph->slot>=0)
+            return lcd_write_diff(LCD_CG_ADDR(LCD_CG_FIRST+glyph->slot), 
+                    glyph->bits, 8)<0 ? -1 : 0;
+        return 0;
+    }
+
+    if(lcd_glyph_count>=LCD_GLYPHS)
         return -1;
+    glyph=&lcd_glyphs[lcd_glyph_count];
+    glyph->code=code;
+    memcpy(glyph->bits, bits, 8);
+    glyph->slot=-1;
+    for(h=lcd_glyph_bucket(code);lcd_glyph_hash[h];h=(h+1)%LCD_GLYPH_HASH)
+        ;
+    lcd_glyph_hash[h]=++lcd_glyph_count;
+
+    // it may take the place of a ROM character
+    lcd_charset_update();
+    return 0;
+}
 
-    // clear screen
-    if(lcd_cmd(CMD_AUTO_WRITE)<0)
+static char lcd_set_charset(unsigned int type, const u32 *map) {
+    if(type>T6963_CHARSET_USER)
         return -1;
-    for(i=lcd_stat.graphics_base;
-        i<lcd_stat.graphics_base+(2*(8*lcd_stat.row_width*lcd_stat.rows))
-        ;i++) {
-        if(lcd_auto_write(0x00)<0)
+    lcd_charset=type;
+    if(type==T6963_CHARSET_USER)
+        memcpy(lcd_charset_map, map, sizeof(lcd_charset_map));
+    lcd_charset_update();
+    return 0;
+}
+
+/* characters in count bytes of text, UTF-8 continuation bytes don't count */
+static int lcd_text_chars(const u8 *text, int count) {
+    int i, n;
+
+    if(lcd_charset!=T6963_CHARSET_UTF8)
+        return count;
+    for(i=0,n=0;i<count;i++) {
+        if((text[i]&0xc0)!=0x80)
+            n++;
+    }
+    return n;
+}
+
+/* how much of count bytes of text to take so no UTF-8 character is split
+ * between writes, and how many characters that is
+ */
+static int lcd_text_len(const u8 *text, int count, int *chars) {
+    int i, n;
+
+    if(lcd_charset==T6963_CHARSET_UTF8 && count>0) {
+        // back to the start of the last character
+        for(i=count-1;i>0 && i>count-4 && (text[i]&0xc0)==0x80;i--)
+            ;
+        n=text[i]>=0xf0 ? 4 : text[i]>=0xe0 ? 3 : text[i]>=0xc0 ? 2 : 1;
+        if(i>0 && i+n>count)
+            count=i;
+    }
+    *chars=lcd_text_chars(text, count);
+    return count;
+}
+
+/* write count bytes of text in the current charset to display RAM at addr.
+ * The text is turned into character codes first, uploading any glyphs that
+ * aren't in CG RAM yet, and goes through lcd_write_diff(), so only the
+ * characters that changed are sent. A broken UTF-8 sequence shows up as '?'.
+ *
+ * returns the number of characters written or -1 on failure
+ */
+static u8 lcd_text_codes[LCD_RAM_SIZE];
+
+static int lcd_write_text_at(unsigned int addr, const u8 *text, int count) {
+    int i, n, left=0;
+    short code;
+    u32 cp=0;
+
+    if(count<=0)
+        return 0;
+    if(addr>=LCD_RAM_SIZE)
+        return -1;
+    if(count>LCD_RAM_SIZE-addr)
+        count=LCD_RAM_SIZE-addr;
+
+    lcd_cg_clock++;
+    lcd_cg_over=addr;
+    lcd_cg_over_end=addr+lcd_text_chars(text, count);
+    for(i=0,n=0;i<count;i++) {
+        if(lcd_charset==T6963_CHARSET_UTF8 && text[i]>=0x80) {
+            if(text[i]<0xc0) {
+                // continuation, the character is done after the last one
+                if(!left)
+                    continue;
+                cp=cp<<6 | (text[i]&0x3f);
+                if(--left)
+                    continue;
+                code=lcd_map_code(cp);
+                lcd_text_codes[n-1]=code<0 ? lcd_glyph_code(-code-1) : code;
+                continue;
+            }
+            left=text[i]>=0xf0 ? 3 : text[i]>=0xe0 ? 2 : 1;
+            cp=text[i]&(0x3f>>left);
+            lcd_text_codes[n++]=LCD_CODE_UNKNOWN;
+            continue;
+        }
+
+        left=0;
+        code=lcd_byte_code[text[i]];
+        lcd_text_codes[n++]=code<0 ? lcd_glyph_code(-code-1) : code;
+    }
+    return lcd_write_diff(addr, lcd_text_codes, n)<0 ? -1 : n;
+}
+
+/* Fill count bytes at addr with plen (1-8) pattern bytes over and over,
+ * starting with the first one at addr. Bytes already known to hold the
+ * pattern are skipped, the rest go out the way lcd_write_diff() sends them.
+ *
+ * returns count or -1 on failure
+ */
+#define LCD_FILL_CHUNK  256
+
+static int lcd_fill(unsigned int addr, int count, const u8 *pattern, int plen) {
+    static u8 buf[LCD_FILL_CHUNK+8];
+    int i, n;
+
+    if(addr>=LCD_RAM_SIZE || plen<1 || plen>8)
+        return -1;
+    if(count>LCD_RAM_SIZE-addr)
+        count=LCD_RAM_SIZE-addr;
+
+    // a whole number of patterns a chunk, so every chunk starts over
+    n=LCD_FILL_CHUNK-LCD_FILL_CHUNK%plen;
+    for(i=0;i<n;i++)
+        buf[i]=pattern[i%plen];
+    for(i=0;i<count;i+=n) {
+        if(lcd_write_diff(addr+i, buf, count-i<n ? count-i : n)<0)
             return -1;
     }
+    return count;
+}
 
-    printk("t6963: graphics memory from 0x%04x to 0x%04x cleared.\n", lcd_stat.graphics_base, i);
+static char lcd_text_clear(void) {
+    u8 space=0x00;
 
-    if(lcd_cmd(CMD_AUTO_RESET)<0)
+    if(lcd_fill(lcd_stat.text_base, lcd_stat.graphics_base-lcd_stat.text_base,
+                &space, 1)<0)
+        return -1;
+    return 0;
+}
+
+static char lcd_graphics_clear(void) {
+    unsigned int len=2*(8*lcd_stat.row_width*lcd_stat.rows);
+    u8 blank=0x00;
+
+    // but not the glyph cache
+    if(lcd_stat.graphics_base>=lcd_stat.graphics_end)
+        return 0;
+    if(len>lcd_stat.graphics_end-lcd_stat.graphics_base)
+        len=lcd_stat.graphics_end-lcd_stat.graphics_base;
+    if(lcd_fill(lcd_stat.graphics_base, len, &blank, 1)<0)
         return -1;
     return 0;
 }
 
 static void lcd_enable_cursor(void) {
     lcd_stat.display_mode |= DISPLAYMODE_CUR;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_disable_cursor(void) {
     lcd_stat.display_mode &= ~DISPLAYMODE_CUR;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_enable_graphics(void) {
     lcd_stat.display_mode |= DISPLAYMODE_GRPH;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_disable_graphics(void) {
     lcd_stat.display_mode &= ~DISPLAYMODE_GRPH;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_enable_text(void) {
     lcd_stat.display_mode |= DISPLAYMODE_TEXT;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_disable_text(void) {
     lcd_stat.display_mode &= ~DISPLAYMODE_TEXT;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_enable_blink(void) {
     lcd_stat.display_mode |= DISPLAYMODE_BLK;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
 }
 
 static void lcd_disable_blink(void) {
     lcd_stat.display_mode &= ~DISPLAYMODE_BLK;
-    lcd_cmd(CMD_DISPLAYMODE | lcd_stat.display_mode);
+    lcd_update_display_mode();
+}
+
+static char lcd_reset(unsigned char rows, unsigned char cols) {
+    lcd_stat.cols=cols;
+    lcd_stat.rows=rows;
+    lcd_stat.text_base=0x02;
+    lcd_stat.graphics_base=lcd_stat.text_base+rows*cols+(2*cols);
+    lcd_stat.row_width=cols%8?cols+(8-(cols%8)):cols;
+
+    if(LCD_DEBUG) {
+        printk("t6963: graphics base: 0x%04x row width: 0x%02x\n", 
+                lcd_stat.graphics_base, lcd_stat.row_width);
+        printk("t6963: text base: 0x%04x row width: 0x%02x\n", lcd_stat.text_base, 
+                lcd_stat.row_width);
+    }
+
+    // we have no idea what is in display RAM until it's been cleared
+    lcd_shadow_forget(0, LCD_RAM_SIZE);
+
+    lcd_bus_init();
+    lcd_burst_ok=1;
+    lcd_hw_forget();
+
+    if(lcd_cmd(CMD_AUTO_RESET)<0)
+        return -1;
+
+    // everything off
+    lcd_stat.display_mode=0;
+    if(lcd_update_display_mode()<0)
+        return -1;
+
+    if(lcd_cmd_long(lcd_stat.graphics_base-2, CMD_GRAPHIC_HOME_ADDR)<0)
+        return -1;
+    if(lcd_cmd_d2(lcd_stat.row_width, 0, CMD_GRAPHIC_AREA_SET)<0)
+        return -1;
+
+    if(lcd_set_text_home(lcd_stat.text_base)<0)
+        return -1;
+    if(lcd_cmd_d2(cols, 0x00, CMD_TEXT_AREA_SET)<0)
+        return -1;
+    if(lcd_cg_reset()<0)
+        return -1;
+
+    if(lcd_set_mode(MODESET_XOR)<0)
+        return -1;
+    
+    if(lcd_graphics_clear()<0)
+        return -1;
+    if(lcd_text_clear()<0)
+        return -1;
+
+    if(lcd_set_addr(lcd_stat.graphics_base)<0)
+        return -1;
+    lcd_addr_ptr=lcd_stat.graphics_base;
+
+    lcd_stat.display_mode=DISPLAYMODE_CUR | DISPLAYMODE_GRPH;
+    if(lcd_update_display_mode()<0)
+        return -1;
+
+    printk("t6963: reset complete\n");
+    return 0;
 }
@@ -52,6 +52,7 @@
                                      // lines desired
 
 #define CMD_CURSOR_POS          0x21 // sets the position of the cursor
+#define CMD_OFFSET_REG          0x22 // sets the CG RAM offset (address bits 11-15)
 
 // ioctl commands
 enum {
@@ -66,6 +67,19 @@ enum {
     T6963_CLEAR_GRAPHICS,
     T6963_CLEAR_TEXT,
     T6963_GET_STATUS,
+    T6963_WRITE_RECT,
+    T6963_FLUSH,
+    T6963_QUEUE_FLIP,
+    T6963_WAIT_FRAME,
+    T6963_SET_FRAME_RATE,
+    T6963_SET_PLANES,
+    T6963_SET_GRAPHICS_AREA,
+    T6963_SET_VIEWPORT,
+    T6963_SET_CHARSET,
+    T6963_DEFINE_GLYPH,
+    T6963_READ_HW,
+    T6963_FILL,
+    T6963_DRAW,
 };
 
 struct t6963_status {
@@ -77,7 +91,124 @@ struct t6963_status {
     unsigned char display_mode; // CMD_DISPLAYMODE bitmask
     unsigned char status; // most recent LCD status
     unsigned char entry_mode; // 1- text entry, 0- graphics entry
+    unsigned int graphics_end; // graphics stays below this, CG RAM is above
 
 };
 
+// argument to T6963_WRITE_RECT
+struct t6963_rect {
+    unsigned int addr; // LCD address of the top left byte
+    unsigned int width; // bytes per row to write
+    unsigned int height; // number of rows, rows are row_width apart on the LCD
+    unsigned int stride; // bytes from one row to the next in data
+    const unsigned char *data;
+};
+
+// argument to T6963_FLUSH, pass NULL to flush all of display RAM
+struct t6963_range {
+    unsigned int addr;
+    unsigned int len;
+};
+
+// argument to T6963_SET_PLANES, the driver shows base[0] for dwell_us[0]
+// microseconds, then base[1] and so on round and round. count 0 stops it.
+#define T6963_MAX_PLANES    8
+struct t6963_planes {
+    unsigned int count;
+    unsigned int base[T6963_MAX_PLANES]; // graphics buffer addresses
+    unsigned int dwell_us[T6963_MAX_PLANES];
+};
+
+// argument to T6963_SET_VIEWPORT. T6963_SET_GRAPHICS_AREA makes graphics rows
+// wider than the panel, the viewport picks which part of that canvas is shown,
+// x in bytes and y in pixel rows from the graphics base at the time the area
+// was set. x may run past the end of a row, the LCD then shows the start of
+// the next one.
+struct t6963_viewport {
+    unsigned int x;
+    unsigned int y;
+};
+
+// argument to T6963_SET_CHARSET, how text mode writes turn into characters.
+// USER looks every byte up in map, which holds Unicode code points. Code
+// points 0x20-0x7f come from the character ROM, anything else needs a glyph
+// from T6963_DEFINE_GLYPH or shows up as '?'. A map entry with
+// T6963_CHARSET_ROM set names ROM code 0x00-0x7f directly instead. ASCII
+// keeps bytes 0x80-0x9f on the ROM's extended characters 0x60-0x7f.
+#define T6963_CHARSET_ROM   0x80000000
+
+enum {
+    T6963_CHARSET_ASCII,        // one byte a character, the default
+    T6963_CHARSET_UTF8,
+    T6963_CHARSET_USER,
+};
+
+struct t6963_charset {
+    unsigned int type;
+    unsigned int map[256];
+};
+
+// argument to T6963_DEFINE_GLYPH, an 8x8 character for a code point. It takes
+// the place of the ROM character if there is one. The driver keeps up to 256.
+struct t6963_glyph {
+    unsigned int code; // Unicode code point
+    unsigned char bits[8]; // top row first, most significant bit on the left
+};
+
+// T6963_READ_HW takes an unsigned int. read() normally answers from the
+// driver's copy of display RAM and only goes to the LCD for bytes the driver
+// doesn't know, 1 makes it read everything from the LCD, 0 goes back.
+
+// argument to T6963_FILL. Fills len bytes from addr, or with height set a
+// rectangle len bytes wide with rows row_width apart, with the first
+// pattern_len (1-8) bytes of pattern over and over. Every row starts with
+// pattern[0]. Bytes that already hold the pattern aren't sent again.
+struct t6963_fill {
+    unsigned int addr;
+    unsigned int len;
+    unsigned int height; // 0 for a plain range
+    unsigned int pattern_len;
+    unsigned char pattern[8];
+};
+
+// argument to T6963_DRAW, a buffer of drawing commands run one after the
+// other on the driver's copy of graphics memory. Only the bytes they touch
+// are sent to the LCD afterwards, and only if they changed.
+struct t6963_draw {
+    unsigned int len; // bytes in cmds
+    const unsigned char *cmds;
+};
+
+// every command starts with one of these, packed one after the other.
+// Coordinates are pixels from the graphics base set with
+// T6963_SET_GRAPHICS_BASE, rows row_width bytes apart, and anything outside
+// display RAM is left out.
+struct t6963_draw_cmd {
+    unsigned char op; // T6963_DRAW_*
+    unsigned char rop; // T6963_ROP_*
+    unsigned short x;
+    unsigned short y;
+    short w;
+    short h;
+};
+
+enum {
+    T6963_DRAW_PIXEL,       // x,y
+    T6963_DRAW_HLINE,       // w pixels right from x,y
+    T6963_DRAW_VLINE,       // h pixels down from x,y
+    T6963_DRAW_LINE,        // from x,y to x+w,y+h
+    T6963_DRAW_RECT,        // w x h outline with the top left corner at x,y
+    T6963_DRAW_FILL_RECT,
+    T6963_DRAW_BLIT,        // w x h bitmap at x,y, followed by h rows of
+                            // (w+7)/8 bytes, leftmost pixel in the top bit
+};
+
+// what the pixels of a shape or the set bits of a bitmap do to what's there,
+// the first three are the same as the CMD_MODESET ones
+#define T6963_ROP_OR        MODESET_OR  // set
+#define T6963_ROP_XOR       MODESET_XOR // flip
+#define T6963_ROP_AND       MODESET_AND // keep only where the bitmap is set
+#define T6963_ROP_COPY      3           // bitmap replaces what's there
+#define T6963_ROP_CLEAR     4           // clear
+
 #endif
@@ -0,0 +1,296 @@
+/*******************************************************************************
+ * T6963C drawing commands
+ *
+ * Runs the T6963_DRAW command buffers against an image of display RAM, one
+ * byte per 8 pixels and rows row_width bytes apart like the LCD has it. Every
+ * byte a command writes to is marked in lcd_draw_touched, lcd_draw_flush()
+ * then only looks at those when it sends the result.
+ *
+ * Included from t6963_graphics.c, not built on its own.
+ *
+ ******************************************************************************/
+
+static u8 lcd_draw_touched[LCD_RAM_SIZE/8];
+static unsigned int lcd_draw_first=LCD_RAM_SIZE, lcd_draw_end;
+
+/* what the command being run draws into */
+static u8 *lcd_draw_ram;
+static unsigned int lcd_draw_base, lcd_draw_width;
+
+/* apply rop to the bits of the byte at addr in mask, src holds the bitmap bits
+ * for a blit and is all ones for shapes
+ */
+static void lcd_draw_byte(unsigned int addr, u8 mask, u8 src, int rop) {
+    u8 *p=lcd_draw_ram+addr;
+
+    switch(rop) {
+        case T6963_ROP_OR:
+            *p |= src & mask;
+            break;
+        case T6963_ROP_XOR:
+            *p ^= src & mask;
+            break;
+        case T6963_ROP_AND:
+            *p &= src | ~mask;
+            break;
+        case T6963_ROP_COPY:
+            *p = (*p & ~mask) | (src & mask);
+            break;
+        case T6963_ROP_CLEAR:
+            *p &= ~(src & mask);
+            break;
+    }
+
+    lcd_draw_touched[addr>>3] |= 1<<(addr&7);
+    if(addr<lcd_draw_first)
+        lcd_draw_first=addr;
+    if(addr>=lcd_draw_end)
+        lcd_draw_end=addr+1;
+}
+
+/* address of the byte holding pixel x,y, -1 if it's off the canvas */
+static int lcd_draw_addr(int x, int y) {
+    unsigned int addr;
+
+    if(x<0 || y<0 || x>=8*lcd_draw_width)
+        return -1;
+    addr=lcd_draw_base+y*lcd_draw_width+x/8;
+    return addr<lcd_stat.graphics_end ? addr : -1;
+}
+
+/* rows of the canvas, the last one may run into the glyph cache part way */
+static int lcd_draw_rows(void) {
+    if(lcd_draw_base>=lcd_stat.graphics_end)
+        return 0;
+    return (lcd_stat.graphics_end-lcd_draw_base+lcd_draw_width-1)/lcd_draw_width;
+}
+
+static void lcd_draw_pixel(int x, int y, int rop) {
+    int addr=lcd_draw_addr(x, y);
+
+    if(addr>=0)
+        lcd_draw_byte(addr, 0x80>>(x&7), 0xff, rop);
+}
+
+/* pixels x0 up to x1 of row y, whole bytes at a time */
+static void lcd_draw_span(int x0, int x1, int y, int rop) {
+    int x, addr;
+    u8 mask;
+
+    if(x0<0)
+        x0=0;
+    if(x1>(int)(8*lcd_draw_width))
+        x1=8*lcd_draw_width;
+    for(x=x0;x<x1;x=(x|7)+1) {
+        if((addr=lcd_draw_addr(x, y))<0)
+            return;
+        mask=0xff>>(x&7);
+        if((x|7)+1>x1)
+            mask &= 0xff<<(8-(x1&7));
+        lcd_draw_byte(addr, mask, 0xff, rop);
+    }
+}
+
+static void lcd_draw_vline(int x, int y0, int y1, int rop) {
+    int rows=lcd_draw_rows();
+
+    if(x<0 || x>=8*lcd_draw_width)
+        return;
+    if(y0<0)
+        y0=0;
+    if(y1>rows)
+        y1=rows;
+    for(;y0<y1;y0++)
+        lcd_draw_pixel(x, y0, rop);
+}
+
+/* Bresenham, every pixel exactly once so XOR lines come out right. Only the
+ * steps along the long axis that land on the canvas are taken, the line
+ * starts at the first of them with the short axis where the whole line would
+ * have had it, so a clipped line has the same pixels as the part of the
+ * whole line that shows.
+ */
+static void lcd_draw_line(int x0, int y0, int x1, int y1, int rop) {
+    int dx=x1>x0 ? x1-x0 : x0-x1, sx=x1>x0 ? 1 : -1;
+    int dy=y1>y0 ? y1-y0 : y0-y1, sy=y1>y0 ? 1 : -1;
+    int xmajor=dx>=dy;
+    int len=xmajor ? dx : dy, p=xmajor ? x0 : y0, sp=xmajor ? sx : sy;
+    int limit=xmajor ? 8*lcd_draw_width : lcd_draw_rows();
+    int n, end, m;
+    unsigned int r, step;
+
+    if(!len) {
+        lcd_draw_pixel(x0, y0, rop);
+        return;
+    }
+
+    // steps n of the long axis that are on the canvas
+    n=sp>0 ? -p : p-(limit-1);
+    end=sp>0 ? limit-1-p : p;
+    if(n<0)
+        n=0;
+    if(end>len)
+        end=len;
+
+    // the short axis moves floor((2*n*short+len)/(2*len)) in n steps, none
+    // of that overflows as both axes are at most 0x8000 long
+    step=2*(xmajor ? dy : dx);
+    r=n*step+len;
+    m=r/(2*len);
+    r%=2*len;
+
+    for(;n<=end;n++) {
+        if(xmajor)
+            lcd_draw_pixel(x0+sx*n, y0+sy*m, rop);
+        else
+            lcd_draw_pixel(x0+sx*m, y0+sy*n, rop);
+        r+=step;
+        if(r>=2*len) {
+            r-=2*len;
+            m++;
+        }
+    }
+}
+
+/* the corners only once, again for XOR */
+static void lcd_draw_rect(int x, int y, int w, int h, int rop) {
+    lcd_draw_span(x, x+w, y, rop);
+    if(h>1)
+        lcd_draw_span(x, x+w, y+h-1, rop);
+    lcd_draw_vline(x, y+1, y+h-1, rop);
+    if(w>1)
+        lcd_draw_vline(x+w-1, y+1, y+h-1, rop);
+}
+
+/* rows past the bottom of the canvas are clipped, not wrapped */
+static void lcd_draw_fill(int x, int y, int w, int h, int rop) {
+    int rows=lcd_draw_rows();
+
+    if(y<0) {
+        h+=y;
+        y=0;
+    }
+    if(y+h>rows)
+        h=rows-y;
+    for(;h>0;h--,y++)
+        lcd_draw_span(x, x+w, y, rop);
+}
+
+/* a bitmap with rows of (w+7)/8 bytes, shifted into place a byte at a time */
+static void lcd_draw_blit(int x, int y, int w, int h, const u8 *bits, int rop) {
+    int stride=(w+7)/8, shift=x&7, row, k, addr, n;
+    const u8 *src;
+    u8 mask, val;
+
+    if(w<=0)
+        return;
+    n=(x+w+7)/8-x/8;
+    for(row=0;row<h;row++,bits+=stride) {
+        for(k=0;k<n;k++) {
+            if((addr=lcd_draw_addr((x&~7)+8*k, y+row))<0)
+                break;
+
+            // source bits that land in this byte
+            src=bits+k;
+            val=(k<stride ? *src>>shift : 0);
+            if(k>0 && shift)
+                val |= src[-1]<<(8-shift);
+
+            mask=0xff;
+            if(!k)
+                mask=0xff>>shift;
+            if(k==n-1 && (x+w)&7)
+                mask &= 0xff<<(8-((x+w)&7));
+            lcd_draw_byte(addr, mask, val, rop);
+        }
+    }
+}
+
+/* the size of the command at cmds, 0 if it's broken or doesn't fit in len */
+static unsigned int lcd_draw_size(const u8 *cmds, unsigned int len) {
+    struct t6963_draw_cmd c;
+    unsigned int size=sizeof(c);
+
+    if(len<size)
+        return 0;
+    memcpy(&c, cmds, sizeof(c));
+    if(c.op>T6963_DRAW_BLIT || c.rop>T6963_ROP_CLEAR)
+        return 0;
+    if(c.op==T6963_DRAW_BLIT) {
+        if(c.w<0 || c.h<0)
+            return 0;
+        size+=c.h*((c.w+7)/8);
+    }
+    return size<=len ? size : 0;
+}
+
+/* check a whole buffer before it's queued, returns 0 if it can be run */
+static int lcd_draw_check(const u8 *cmds, unsigned int len) {
+    unsigned int size;
+
+    for(;len>0;cmds+=size,len-=size) {
+        if(!(size=lcd_draw_size(cmds, len)))
+            return -1;
+    }
+    return 0;
+}
+
+/* run a checked buffer on ram, with the canvas at base */
+static void lcd_draw(const u8 *cmds, unsigned int len, u8 *ram,
+        unsigned int base, unsigned int row_width) {
+    struct t6963_draw_cmd c;
+    unsigned int size;
+
+    lcd_draw_ram=ram;
+    lcd_draw_base=base;
+    lcd_draw_width=row_width;
+
+    for(;len>0;cmds+=size,len-=size) {
+        if(!(size=lcd_draw_size(cmds, len)))
+            return;
+        memcpy(&c, cmds, sizeof(c));
+
+        switch(c.op) {
+            case T6963_DRAW_PIXEL:
+                lcd_draw_pixel(c.x, c.y, c.rop);
+                break;
+            case T6963_DRAW_HLINE:
+                lcd_draw_span(c.x, c.x+c.w, c.y, c.rop);
+                break;
+            case T6963_DRAW_VLINE:
+                lcd_draw_vline(c.x, c.y, c.y+c.h, c.rop);
+                break;
+            case T6963_DRAW_LINE:
+                lcd_draw_line(c.x, c.y, c.x+c.w, c.y+c.h, c.rop);
+                break;
+            case T6963_DRAW_RECT:
+                if(c.w>0 && c.h>0)
+                    lcd_draw_rect(c.x, c.y, c.w, c.h, c.rop);
+                break;
+            case T6963_DRAW_FILL_RECT:
+                lcd_draw_fill(c.x, c.y, c.w, c.h, c.rop);
+                break;
+            case T6963_DRAW_BLIT:
+                lcd_draw_blit(c.x, c.y, c.w, c.h, cmds+sizeof(c), c.rop);
+                break;
+        }
+    }
+}
+
+/* send what the commands touched and start over. ram can change under us if
+ * it's mapped, what goes out and into the shadow comes from a copy in snap.
+ */
+static int lcd_draw_flush(const u8 *ram, u8 *snap) {
+    int ret=0;
+
+    if(lcd_draw_first<lcd_draw_end) {
+        memcpy(snap+lcd_draw_first, ram+lcd_draw_first, 
+                lcd_draw_end-lcd_draw_first);
+        ret=lcd_write_marked(snap, lcd_draw_touched, lcd_draw_first, 
+                lcd_draw_end);
+    }
+    memset(lcd_draw_touched, 0x00, sizeof(lcd_draw_touched));
+    lcd_draw_first=LCD_RAM_SIZE;
+    lcd_draw_end=0;
+    return ret;
+}
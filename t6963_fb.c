@@ -0,0 +1,192 @@
+/*******************************************************************************
+ * T6963C framebuffer console front end
+ *
+ * Registers the graphics area of the LCD as a 1 bit per pixel /dev/fbN so the
+ * usual framebuffer tools can draw on it. Writes to the mapped framebuffer are
+ * collected with deferred I/O and only the touched pages are diffed against
+ * the shadow and sent over the parallel port, once per lcd_fb_delay ms.
+ *
+ ******************************************************************************/
+
+#include <linux/fb.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+
+#include "t6963.c"
+
+/* milliseconds to gather writes before they go out to the LCD */
+static int lcd_fb_delay = 50;
+module_param(lcd_fb_delay, int, 0);
+
+static struct fb_info *lcd_fb_info;
+static u8 *lcd_fb_mem;
+static unsigned int lcd_fb_size;
+
+/* set when the fb_ops drawing functions touched the framebuffer, those don't
+ * go through the page fault path so they never show up in the page list
+ */
+static int lcd_fb_dirty;
+
+/* the framebuffer can change under a flush, what goes out and what the shadow
+ * records both come from this copy
+ */
+static u8 lcd_fb_snap[LCD_RAM_SIZE];
+
+static struct fb_fix_screeninfo lcd_fb_fix = {
+    .id =           "t6963",
+    .type =         FB_TYPE_PACKED_PIXELS,
+    .visual =       FB_VISUAL_MONO01,
+    .accel =        FB_ACCEL_NONE,
+};
+
+static struct fb_var_screeninfo lcd_fb_var = {
+    .bits_per_pixel =   1,
+    .activate =         FB_ACTIVATE_NOW,
+    .red =              { 0, 1, 0 },
+    .green =            { 0, 1, 0 },
+    .blue =             { 0, 1, 0 },
+};
+
+/* send len bytes of the framebuffer starting at off to graphics memory */
+static void lcd_fb_flush(unsigned int off, unsigned int len) {
+    if(off>=lcd_fb_size)
+        return;
+    if(len>lcd_fb_size-off)
+        len=lcd_fb_size-off;
+
+    if(len>sizeof(lcd_fb_snap))
+        len=sizeof(lcd_fb_snap);
+
+    memcpy(lcd_fb_snap, lcd_fb_mem+off, len);
+    if(lcd_write_diff(lcd_stat.graphics_base+off, lcd_fb_snap, len)<0)
+        printk("t6963: framebuffer flush at 0x%04x failed\n", off);
+}
+
+static void lcd_fb_deferred_io(struct fb_info *info, struct list_head *pagelist) {
+    struct page *page;
+
+    if(lcd_fb_dirty) {
+        lcd_fb_dirty=0;
+        lcd_fb_flush(0, lcd_fb_size);
+        return;
+    }
+
+    list_for_each_entry(page, pagelist, lru)
+        lcd_fb_flush(page->index<<PAGE_SHIFT, PAGE_SIZE);
+}
+
+static struct fb_deferred_io lcd_fb_defio = {
+    .deferred_io =  lcd_fb_deferred_io,
+};
+
+/* the drawing functions and write() don't fault, so kick the flush by hand */
+static void lcd_fb_touch(struct fb_info *info) {
+    lcd_fb_dirty=1;
+    schedule_delayed_work(&info->deferred_work, info->fbdefio->delay);
+}
+
+static ssize_t lcd_fb_write(struct fb_info *info, const char __user *buf,
+        size_t count, loff_t *ppos) {
+    ssize_t ret;
+
+    ret=fb_sys_write(info, buf, count, ppos);
+    if(ret>0)
+        lcd_fb_touch(info);
+    return ret;
+}
+
+static void lcd_fb_fillrect(struct fb_info *info, const struct fb_fillrect *rect) {
+    sys_fillrect(info, rect);
+    lcd_fb_touch(info);
+}
+
+static void lcd_fb_copyarea(struct fb_info *info, const struct fb_copyarea *area) {
+    sys_copyarea(info, area);
+    lcd_fb_touch(info);
+}
+
+static void lcd_fb_imageblit(struct fb_info *info, const struct fb_image *image) {
+    sys_imageblit(info, image);
+    lcd_fb_touch(info);
+}
+
+static struct fb_ops lcd_fb_ops = {
+    .owner =        THIS_MODULE,
+    .fb_read =      fb_sys_read,
+    .fb_write =     lcd_fb_write,
+    .fb_fillrect =  lcd_fb_fillrect,
+    .fb_copyarea =  lcd_fb_copyarea,
+    .fb_imageblit = lcd_fb_imageblit,
+};
+
+int __init lcd_fb_init(void) {
+    struct fb_info *info;
+    int err;
+
+    if((err=lcd_claim_port("t6963_fb"))<0)
+        return err;
+    if(lcd_reset(LCD_ROWS, LCD_COLS)<0)
+        printk("t6963: reset failed!\n");
+
+    // one graphics screen, rows are row_width bytes apart like on the LCD
+    lcd_fb_size=8*lcd_stat.row_width*lcd_stat.rows;
+    lcd_fb_mem=vmalloc(PAGE_ALIGN(lcd_fb_size));
+    if(!lcd_fb_mem) {
+        lcd_release_port();
+        return -ENOMEM;
+    }
+    memset(lcd_fb_mem, 0x00, PAGE_ALIGN(lcd_fb_size));
+
+    info=framebuffer_alloc(0, NULL);
+    if(!info) {
+        vfree(lcd_fb_mem);
+        lcd_release_port();
+        return -ENOMEM;
+    }
+
+    lcd_fb_fix.smem_start=(unsigned long)lcd_fb_mem;
+    lcd_fb_fix.smem_len=lcd_fb_size;
+    lcd_fb_fix.line_length=lcd_stat.row_width;
+
+    lcd_fb_var.xres=8*lcd_stat.cols;
+    lcd_fb_var.yres=8*lcd_stat.rows;
+    lcd_fb_var.xres_virtual=8*lcd_stat.row_width;
+    lcd_fb_var.yres_virtual=8*lcd_stat.rows;
+
+    info->screen_base=(char __iomem *)lcd_fb_mem;
+    info->screen_size=lcd_fb_size;
+    info->fbops=&lcd_fb_ops;
+    info->fix=lcd_fb_fix;
+    info->var=lcd_fb_var;
+    info->flags=FBINFO_FLAG_DEFAULT | FBINFO_VIRTFB;
+
+    lcd_fb_defio.delay=msecs_to_jiffies(lcd_fb_delay);
+    info->fbdefio=&lcd_fb_defio;
+    fb_deferred_io_init(info);
+
+    if(register_framebuffer(info)<0) {
+        fb_deferred_io_cleanup(info);
+        framebuffer_release(info);
+        vfree(lcd_fb_mem);
+        lcd_release_port();
+        printk("t6963: can't register framebuffer\n");
+        return -EIO;
+    }
+    lcd_fb_info=info;
+
+    printk("t6963: fb%d, %dx%d, flushing every %d ms\n", info->node,
+            lcd_fb_var.xres, lcd_fb_var.yres, lcd_fb_delay);
+    return 0;
+}
+
+void __exit lcd_fb_exit(void) {
+    // nothing can schedule another flush once it's unregistered
+    unregister_framebuffer(lcd_fb_info);
+    fb_deferred_io_cleanup(lcd_fb_info);
+    framebuffer_release(lcd_fb_info);
+    vfree(lcd_fb_mem);
+    lcd_release_port();
+}
+
+module_init(lcd_fb_init);
+module_exit(lcd_fb_exit);
@@ -1,82 +1,643 @@
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <asm/semaphore.h>
+
 #include "t6963.c"
+#include "t6963_draw.c"
 
 static int lcd_major;
 
-static char lcd_reset(unsigned char rows, unsigned char cols) {
-    lcd_stat.cols=cols;
-    lcd_stat.rows=rows;
-    lcd_stat.text_base=0x02;
-    lcd_stat.graphics_base=lcd_stat.text_base+rows*cols+(2*cols);
-    lcd_stat.row_width=cols%8?cols+(8-(cols%8)):cols;
+/* bounce buffer for data coming in from userspace */
+static u8 lcd_wbuf[LCD_RAM_SIZE];
+
+/* Page backed image of the display RAM that userspace can mmap() and draw
+ * into. write() and the upload ioctls land here too, T6963_FLUSH pushes
+ * whatever differs from the shadow out to the LCD.
+ */
+static u8 *lcd_vram;
+#define LCD_VRAM_ORDER  get_order(LCD_RAM_SIZE)
+
+/* Userspace can change lcd_vram while the thread sends it, so the thread
+ * works from a copy. Data always goes out of the same buffer the shadow is
+ * then updated from.
+ */
+static u8 lcd_snap[LCD_RAM_SIZE];
+
+/* Transfers are queued on a ring and sent by a kernel thread, so write() and
+ * the upload ioctls return as soon as the data is copied in. There is one
+ * producer at a time (lcd_submit_sem) and one consumer (lcd_thread), so the
+ * ring itself needs no lock: the producer only moves head, the thread only
+ * moves tail. Each slot owns LCD_RAM_SIZE bytes of lcd_ring_data.
+ */
+#define LCD_RING_SLOTS  8
+
+enum {
+    LCD_XFER_WRITE,     // graphics bytes at addr
+    LCD_XFER_TEXT,      // text in the current charset at addr
+    LCD_XFER_RECT,      // width x height rectangle, rows row_width apart
+    LCD_XFER_FLUSH,     // push len bytes of lcd_vram at addr
+    LCD_XFER_FLIP,      // show the graphics buffer at addr on the next frame
+    LCD_XFER_FILL,      // data is one row of a pattern, repeated height times
+    LCD_XFER_DRAW,      // len bytes of T6963_DRAW commands
+};
+
+struct lcd_xfer {
+    int type;
+    unsigned int addr;
+    unsigned int len;           // bytes per row for LCD_XFER_RECT
+    unsigned int height;
+    u8 *data;
+};
+
+static struct lcd_xfer lcd_ring[LCD_RING_SLOTS];
+static u8 *lcd_ring_data;
+static unsigned int lcd_ring_head;      // next slot to fill, producer only
+static unsigned int lcd_ring_tail;      // next slot to send, thread only
+static int lcd_ring_err;                // set by the thread, reported by fsync
+
+static struct task_struct *lcd_thread;
+static DECLARE_WAIT_QUEUE_HEAD(lcd_xfer_wait);  // thread waits for work
+static DECLARE_WAIT_QUEUE_HEAD(lcd_done_wait);  // producers wait for room
+static DECLARE_MUTEX(lcd_submit_sem);
+static DECLARE_MUTEX(lcd_bus_sem);              // held while talking to the LCD
+
+#define LCD_RING_FULL   (lcd_ring_head-lcd_ring_tail>=LCD_RING_SLOTS)
+#define LCD_RING_EMPTY  (lcd_ring_head==lcd_ring_tail)
+
+/* Frame clock. A high resolution timer ticks at lcd_frame_rate Hz, queued
+ * page flips are applied on the first tick after the uploads queued before
+ * them are done, and T6963_WAIT_FRAME sleeps until the next tick. 0 turns
+ * the clock off, flips then happen as soon as they come up in the queue.
+ */
+static int lcd_frame_rate = 50;
+module_param(lcd_frame_rate, int, 0);
+
+static struct hrtimer lcd_frame_timer;
+static unsigned long lcd_frame_seq;
+static DECLARE_WAIT_QUEUE_HEAD(lcd_frame_wait);
+
+static enum hrtimer_restart lcd_frame_tick(struct hrtimer *timer) {
+    lcd_frame_seq++;
+    wake_up_interruptible(&lcd_frame_wait);
+
+    hrtimer_forward_now(timer, ktime_set(0, 1000000000/lcd_frame_rate));
+    return HRTIMER_RESTART;
+}
+
+static void lcd_frame_clock(int rate) {
+    hrtimer_cancel(&lcd_frame_timer);
+    lcd_frame_rate=rate;
+    if(rate>0)
+        hrtimer_start(&lcd_frame_timer, ktime_set(0, 1000000000/rate),
+                HRTIMER_MODE_REL);
+    // nobody waits for a clock that stopped
+    lcd_frame_seq++;
+    wake_up_interruptible(&lcd_frame_wait);
+}
+
+/* sleep until the next frame tick */
+static int lcd_wait_frame(void) {
+    unsigned long seq=lcd_frame_seq;
+
+    if(lcd_frame_rate<=0)
+        return 0;
+    return wait_event_interruptible(lcd_frame_wait, 
+            lcd_frame_seq!=seq || kthread_should_stop());
+}
+
+/* Plane cycler for grayscale. A second timer steps through a set of graphics
+ * buffers, leaving each up for its own dwell time, and hands the address of
+ * the next one to the thread which sends CMD_GRAPHIC_HOME_ADDR as soon as it
+ * is between transfers. A new set replaces the running one only when the
+ * cycle comes back round to the first plane, so no frame ever mixes planes
+ * from both. lcd_plane_lock covers everything below.
+ */
+#define LCD_PLANE_MIN_US    500     // below this the bus can't keep up
 
-    if(LCD_DEBUG) {
-        printk("t6963: graphics base: 0x%04x row width: 0x%02x\n", 
-                lcd_stat.graphics_base, lcd_stat.row_width);
-        printk("t6963: text base: 0x%04x row width: 0x%02x\n", lcd_stat.text_base, 
-                lcd_stat.row_width);
+static struct hrtimer lcd_plane_timer;
+static DEFINE_SPINLOCK(lcd_plane_lock);
+static struct t6963_planes lcd_planes;      // the set being shown
+static struct t6963_planes lcd_planes_next; // waiting for the cycle to wrap
+static int lcd_planes_pending;
+static unsigned int lcd_plane;              // index into lcd_planes
+static int lcd_plane_due = -1;              // base the thread should show next
+
+static enum hrtimer_restart lcd_plane_tick(struct hrtimer *timer) {
+    unsigned long flags;
+    unsigned int dwell;
+
+    spin_lock_irqsave(&lcd_plane_lock, flags);
+    if(++lcd_plane>=lcd_planes.count) {
+        lcd_plane=0;
+        if(lcd_planes_pending) {
+            lcd_planes=lcd_planes_next;
+            lcd_planes_pending=0;
+        }
     }
+    lcd_plane_due=lcd_planes.base[lcd_plane];
+    dwell=lcd_planes.dwell_us[lcd_plane];
+    spin_unlock_irqrestore(&lcd_plane_lock, flags);
+
+    wake_up_interruptible(&lcd_xfer_wait);
+    hrtimer_forward_now(timer, ns_to_ktime((u64)dwell*1000));
+    return HRTIMER_RESTART;
+}
+
+/* start cycling through planes, or swap in a new set at the end of the
+ * current cycle if it's already running. count 0 stops it right away.
+ */
+static int lcd_set_planes(const struct t6963_planes *p) {
+    unsigned long flags;
+    unsigned int i;
+
+    if(p->count>T6963_MAX_PLANES)
+        return -EINVAL;
+    // every plane is a whole screen and has to stay below the glyph cache
+    for(i=0;i<p->count;i++) {
+        if(p->base[i]<2 || p->base[i]>=lcd_stat.graphics_end || 
+                lcd_stat.graphics_end-p->base[i]<
+                8*lcd_stat.rows*lcd_stat.row_width ||
+                p->dwell_us[i]<LCD_PLANE_MIN_US)
+            return -EINVAL;
+    }
+
+    if(!p->count || !lcd_planes.count) {
+        hrtimer_cancel(&lcd_plane_timer);
+        spin_lock_irqsave(&lcd_plane_lock, flags);
+        lcd_planes=*p;
+        lcd_planes_pending=0;
+        lcd_plane=0;
+        // stopping goes back to the buffer T6963_SET_GRAPHICS_BASE set
+        lcd_plane_due=p->count ? p->base[0] : lcd_stat.graphics_base;
+        spin_unlock_irqrestore(&lcd_plane_lock, flags);
+
+        wake_up_interruptible(&lcd_xfer_wait);
+        if(p->count)
+            hrtimer_start(&lcd_plane_timer, 
+                    ns_to_ktime((u64)p->dwell_us[0]*1000), HRTIMER_MODE_REL);
+        return 0;
+    }
+
+    spin_lock_irqsave(&lcd_plane_lock, flags);
+    lcd_planes_next=*p;
+    lcd_planes_pending=1;
+    spin_unlock_irqrestore(&lcd_plane_lock, flags);
+    return 0;
+}
+
+/* show the plane the timer asked for, called by the thread between transfers */
+static void lcd_plane_switch(void) {
+    unsigned long flags;
+    int base;
+
+    spin_lock_irqsave(&lcd_plane_lock, flags);
+    base=lcd_plane_due;
+    lcd_plane_due=-1;
+    spin_unlock_irqrestore(&lcd_plane_lock, flags);
+
+    if(base<0)
+        return;
+    down(&lcd_bus_sem);
+    if(lcd_cmd_long(base-2, CMD_GRAPHIC_HOME_ADDR)<0)
+        lcd_ring_err=-EIO;
+    up(&lcd_bus_sem);
+}
 
-    if(lcd_cmd(CMD_AUTO_RESET)<0)
-        return -1;
+/* Hardware scrolling. T6963_SET_GRAPHICS_AREA lays graphics memory out as a
+ * canvas with rows wider than the panel, T6963_SET_VIEWPORT then scrolls over
+ * it by moving CMD_GRAPHIC_HOME_ADDR, so a step only costs uploading the strip
+ * that comes into view. lcd_canvas_base is where the canvas starts, the
+ * graphics base moves with the viewport.
+ */
+static unsigned int lcd_canvas_base;
 
-    lcd_disable_graphics();
-    lcd_disable_text();
-    lcd_disable_blink();
-    lcd_disable_cursor();
+/* reset the LCD and start over with an empty image */
+static char t6963_reset(void) {
+    char ret;
 
+    memset(lcd_vram, 0x00, LCD_RAM_SIZE);
+    ret=lcd_reset(LCD_ROWS, LCD_COLS);
+    lcd_canvas_base=lcd_stat.graphics_base;
+    return ret;
+}
+
+/* graphics rows are width bytes apart from now on, 0 goes back to the panel
+ * width. The viewport starts over at the top left of the canvas.
+ */
+static int lcd_set_graphics_area(unsigned int width) {
+    if(!width)
+        width=lcd_stat.cols%8 ? lcd_stat.cols+(8-(lcd_stat.cols%8)) : lcd_stat.cols;
+    if(width<lcd_stat.cols || width>0xff || 
+            lcd_canvas_base+8*lcd_stat.rows*width>lcd_stat.graphics_end)
+        return -EINVAL;
+
+    if(lcd_cmd_d2(width, 0, CMD_GRAPHIC_AREA_SET)<0)
+        return -EIO;
+    lcd_stat.row_width=width;
+    lcd_stat.graphics_base=lcd_canvas_base;
     if(lcd_cmd_long(lcd_stat.graphics_base-2, CMD_GRAPHIC_HOME_ADDR)<0)
-        return -1;
-    if(lcd_cmd_d2(lcd_stat.row_width, 0, CMD_GRAPHIC_AREA_SET)<0)
-        return -1;
-
-    if(lcd_cmd_long(lcd_stat.text_base-2, CMD_TEXT_HOME_ADDR)<0)
-        return -1;
-    if(lcd_cmd_d2(cols, 0x00, CMD_TEXT_AREA_SET)<0)
-        return -1;
-
-    if(lcd_cmd(CMD_MODESET | MODESET_XOR)<0)
-        return -1;
-    
-    if(lcd_graphics_clear()<0)
-        return -1;
-    if(lcd_text_clear()<0)
-        return -1;
-
-    if(lcd_cmd_long(lcd_stat.text_base,CMD_ADDR_PTR)<0) 
-        return -1;
-
-    if(lcd_cmd_long(lcd_stat.graphics_base,CMD_ADDR_PTR)<0) 
-        return -1;
-
-    lcd_enable_cursor();
-    lcd_disable_blink();
-    lcd_disable_text();
-    lcd_enable_graphics();
-
-    printk("t6963: reset complete\n");
+        return -EIO;
     return 0;
 }
 
+/* whether rows rows of x->len bytes at x->addr, row_width apart, stay inside
+ * display RAM. The producers check this too, this is the last line before
+ * lcd_vram.
+ */
+static int lcd_xfer_fits(const struct lcd_xfer *x, unsigned int rows) {
+    if(x->addr>=LCD_RAM_SIZE || x->len>LCD_RAM_SIZE-x->addr)
+        return 0;
+    if(rows<=1)
+        return 1;
+    return rows<=LCD_RAM_SIZE/lcd_stat.row_width &&
+        x->addr+(rows-1)*lcd_stat.row_width+x->len<=LCD_RAM_SIZE;
+}
+
+/* send one queued transfer, called with lcd_bus_sem held */
+static int lcd_xfer_run(struct lcd_xfer *x) {
+    unsigned int row;
+    int n;
+
+    switch(x->type) {
+        case LCD_XFER_WRITE:
+        case LCD_XFER_TEXT:
+        case LCD_XFER_FLUSH:
+            if(!lcd_xfer_fits(x, 1))
+                return -1;
+            break;
+        case LCD_XFER_RECT:
+        case LCD_XFER_FILL:
+            if(!lcd_xfer_fits(x, x->height))
+                return -1;
+            break;
+    }
+
+    switch(x->type) {
+        case LCD_XFER_WRITE:
+            memcpy(lcd_vram+x->addr, x->data, x->len);
+            return lcd_write_diff(x->addr, x->data, x->len);
+        case LCD_XFER_TEXT:
+            if((n=lcd_write_text_at(x->addr, x->data, x->len))<0)
+                return -1;
+            memcpy(lcd_vram+x->addr, lcd_shadow+x->addr, n);
+            return 0;
+        case LCD_XFER_RECT:
+            // full rows packed like the LCD are one contiguous run
+            if(x->len==lcd_stat.row_width) {
+                memcpy(lcd_vram+x->addr, x->data, x->len*x->height);
+                return lcd_write_diff(x->addr, x->data, x->len*x->height);
+            }
+            for(row=0;row<x->height;row++) {
+                memcpy(lcd_vram+x->addr+row*lcd_stat.row_width, 
+                        x->data+row*x->len, x->len);
+                if(lcd_write_diff(x->addr+row*lcd_stat.row_width, 
+                            x->data+row*x->len, x->len)<0)
+                    return -1;
+            }
+            return 0;
+        case LCD_XFER_FLUSH:
+            // userspace may still be drawing, the shadow has to get exactly
+            // what went out
+            memcpy(lcd_snap+x->addr, lcd_vram+x->addr, x->len);
+            return lcd_write_diff(x->addr, lcd_snap+x->addr, x->len);
+        case LCD_XFER_FILL:
+            for(row=0;row<x->height;row++) {
+                memcpy(lcd_vram+x->addr+row*lcd_stat.row_width, x->data, x->len);
+                if(lcd_write_diff(x->addr+row*lcd_stat.row_width,
+                            x->data, x->len)<0)
+                    return -1;
+            }
+            return 0;
+        case LCD_XFER_DRAW:
+            lcd_draw(x->data, x->len, lcd_vram, lcd_canvas_base, lcd_stat.row_width);
+            return lcd_draw_flush(lcd_vram, lcd_snap);
+        case LCD_XFER_FLIP:
+            lcd_stat.graphics_base=x->addr;
+            return lcd_cmd_long(lcd_stat.graphics_base-2, CMD_GRAPHIC_HOME_ADDR);
+    }
+    return 0;
+}
+
+static int lcd_flush_thread(void *unused) {
+    struct lcd_xfer *x;
+
+    while(1) {
+        wait_event_interruptible(lcd_xfer_wait, !LCD_RING_EMPTY || 
+                lcd_plane_due>=0 || kthread_should_stop());
+        lcd_plane_switch();
+        if(LCD_RING_EMPTY && kthread_should_stop())
+            break;
+
+        while(!LCD_RING_EMPTY) {
+            lcd_plane_switch();
+            smp_rmb();
+            x=&lcd_ring[lcd_ring_tail%LCD_RING_SLOTS];
+
+            // everything queued before the flip is out, wait for the frame
+            if(x->type==LCD_XFER_FLIP)
+                lcd_wait_frame();
+
+            down(&lcd_bus_sem);
+            if(lcd_xfer_run(x)<0)
+                lcd_ring_err=-EIO;
+            up(&lcd_bus_sem);
+
+            smp_mb();
+            lcd_ring_tail++;
+            wake_up_interruptible(&lcd_done_wait);
+        }
+    }
+    return 0;
+}
+
+/* grab the next free slot, call lcd_submit() when it's filled in. Returns
+ * with lcd_submit_sem held on success.
+ */
+static struct lcd_xfer *lcd_submit_begin(struct file *file, int *err) {
+    if(down_interruptible(&lcd_submit_sem)) {
+        *err=-ERESTARTSYS;
+        return NULL;
+    }
+    while(LCD_RING_FULL) {
+        up(&lcd_submit_sem);
+        if(file->f_flags & O_NONBLOCK) {
+            *err=-EAGAIN;
+            return NULL;
+        }
+        if(wait_event_interruptible(lcd_done_wait, !LCD_RING_FULL) ||
+                down_interruptible(&lcd_submit_sem)) {
+            *err=-ERESTARTSYS;
+            return NULL;
+        }
+    }
+    return &lcd_ring[lcd_ring_head%LCD_RING_SLOTS];
+}
+
+static void lcd_submit(void) {
+    smp_wmb();
+    lcd_ring_head++;
+    up(&lcd_submit_sem);
+    wake_up_interruptible(&lcd_xfer_wait);
+}
+
+static void lcd_submit_abort(void) {
+    up(&lcd_submit_sem);
+}
+
+/* wait for everything queued to go out and take the bus for ourselves */
+static int lcd_sync_begin(void) {
+    if(wait_event_interruptible(lcd_done_wait, LCD_RING_EMPTY))
+        return -ERESTARTSYS;
+    if(down_interruptible(&lcd_bus_sem))
+        return -ERESTARTSYS;
+    return 0;
+}
+
+static void lcd_sync_end(void) {
+    up(&lcd_bus_sem);
+}
+
 ssize_t t6963_write(struct file *file, const char __user *buf, size_t count, loff_t *offset) {
-    if(lcd_stat.entry_mode) {
-       lcd_write_text(buf, count);
-    } else {
-        lcd_write_bytes(buf, count);
+    struct lcd_xfer *x;
+    int err, chars;
+
+    // the address pointer belongs to whoever holds lcd_submit_sem, and the
+    // glyph cache above graphics_end to the driver
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+    if(lcd_addr_ptr>=lcd_stat.graphics_end) {
+        lcd_submit_abort();
+        return -ENOSPC;
     }
+    if(count>lcd_stat.graphics_end-lcd_addr_ptr)
+        count=lcd_stat.graphics_end-lcd_addr_ptr;
+
+    if(copy_from_user(x->data, buf, count)) {
+        lcd_submit_abort();
+        return -EFAULT;
+    }
+    x->type=lcd_stat.entry_mode ? LCD_XFER_TEXT : LCD_XFER_WRITE;
+    x->addr=lcd_addr_ptr;
+    // a UTF-8 character split at the end waits for the next write
+    chars=count;
+    if(lcd_stat.entry_mode)
+        count=lcd_text_len(x->data, count, &chars);
+    x->len=count;
+    lcd_addr_ptr+=chars;
+    lcd_submit();
+
     return count;
 }
 
-ssize_t t6963_read(struct file *file, char *buf, size_t count, loff_t *offset) {
-    return lcd_read_bytes(buf, count);
+/* set with T6963_READ_HW to check what's really on the LCD */
+static int lcd_read_hw;
+
+ssize_t t6963_read(struct file *file, char __user *buf, size_t count, loff_t *offset) {
+    int len;
+
+    len=count>sizeof(lcd_wbuf)?sizeof(lcd_wbuf):count;
+
+    // queued writes have to be on the LCD, and in the shadow, first
+    if(down_interruptible(&lcd_submit_sem))
+        return -ERESTARTSYS;
+    if(lcd_sync_begin()) {
+        up(&lcd_submit_sem);
+        return -ERESTARTSYS;
+    }
+    if(lcd_addr_ptr>=LCD_RAM_SIZE)
+        len=0;
+    else if((len=lcd_read_shadow(lcd_addr_ptr, lcd_wbuf, len, lcd_read_hw))>0)
+        lcd_addr_ptr+=len;
+    lcd_sync_end();
+    up(&lcd_submit_sem);
+
+    if(len<0)
+        return -EIO;
+
+    if(copy_to_user(buf, lcd_wbuf, len))
+        return -EFAULT;
+    return len;
 }
 
-int t6963_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
-                unsigned long arg) {
+/* queue a rectangle of graphics memory in one go, rows are row_width apart
+ * on the LCD and stride apart in the user buffer
+ */
+static int lcd_write_rect(struct file *file, const struct t6963_rect *rect) {
+    const u8 __user *src=rect->data;
+    struct lcd_xfer *x;
+    unsigned int row;
+    int err;
+
+    if(!rect->width || !rect->height)
+        return 0;
+    // the height is checked first so the end can't wrap around
+    if(rect->width>lcd_stat.row_width || rect->addr>=lcd_stat.graphics_end ||
+            rect->height>LCD_RAM_SIZE/lcd_stat.row_width ||
+            rect->addr+(rect->height-1)*lcd_stat.row_width+rect->width>
+            lcd_stat.graphics_end)
+        return -EINVAL;
+
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+
+    if(rect->stride==rect->width) {
+        err=copy_from_user(x->data, src, rect->width*rect->height);
+    } else {
+        for(row=0,err=0;row<rect->height && !err;row++,src+=rect->stride)
+            err=copy_from_user(x->data+row*rect->width, src, rect->width);
+    }
+    if(err) {
+        lcd_submit_abort();
+        return -EFAULT;
+    }
+
+    x->type=LCD_XFER_RECT;
+    x->addr=rect->addr;
+    x->len=rect->width;
+    x->height=rect->height;
+    lcd_submit();
+    return 0;
+}
+
+/* queue a push of the part of the mmap()ed image that changed */
+static int lcd_flush(struct file *file, unsigned int addr, unsigned int len) {
+    struct lcd_xfer *x;
+    int err;
+
+    // the image has nothing for the glyph cache, it's left alone
+    if(addr>=lcd_stat.graphics_end)
+        return -EINVAL;
+    if(len>lcd_stat.graphics_end-addr)
+        len=lcd_stat.graphics_end-addr;
+
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+    x->type=LCD_XFER_FLUSH;
+    x->addr=addr;
+    x->len=len;
+    lcd_submit();
+    return 0;
+}
+
+/* queue a fill of a range or a rectangle. The pattern is laid out over one
+ * row here, the thread only has to copy it.
+ */
+static int lcd_fill_rect(struct file *file, const struct t6963_fill *fill) {
+    struct lcd_xfer *x;
+    unsigned int i, height=fill->height ? fill->height : 1;
+    int err;
+
+    if(!fill->len)
+        return 0;
+    if(fill->pattern_len<1 || fill->pattern_len>8)
+        return -EINVAL;
+    if(fill->height) {
+        if(fill->len>lcd_stat.row_width || fill->addr>=lcd_stat.graphics_end ||
+                height>LCD_RAM_SIZE/lcd_stat.row_width ||
+                fill->addr+(height-1)*lcd_stat.row_width+fill->len>
+                lcd_stat.graphics_end)
+            return -EINVAL;
+    } else if(fill->addr>=lcd_stat.graphics_end || 
+            fill->len>lcd_stat.graphics_end-fill->addr) {
+        return -EINVAL;
+    }
+
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+    for(i=0;i<fill->len;i++)
+        x->data[i]=fill->pattern[i%fill->pattern_len];
+    x->type=LCD_XFER_FILL;
+    x->addr=fill->addr;
+    x->len=fill->len;
+    x->height=height;
+    lcd_submit();
+    return 0;
+}
+
+/* queue a buffer of drawing commands, they're checked here so the thread
+ * never sees a broken one
+ */
+static int lcd_draw_cmds(struct file *file, const struct t6963_draw *draw) {
+    struct lcd_xfer *x;
+    int err;
+
+    if(!draw->len)
+        return 0;
+    if(draw->len>LCD_RAM_SIZE)
+        return -EINVAL;
+
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+    if(copy_from_user(x->data, draw->cmds, draw->len)) {
+        lcd_submit_abort();
+        return -EFAULT;
+    }
+    if(lcd_draw_check(x->data, draw->len)<0) {
+        lcd_submit_abort();
+        return -EINVAL;
+    }
+    x->type=LCD_XFER_DRAW;
+    x->len=draw->len;
+    lcd_submit();
+    return 0;
+}
+
+/* queue a page flip to the graphics buffer at addr */
+static int lcd_queue_flip(struct file *file, unsigned int addr) {
+    struct lcd_xfer *x;
+    int err;
+
+    if(addr<2 || addr>=lcd_stat.graphics_end)
+        return -EINVAL;
+    if(!(x=lcd_submit_begin(file, &err)))
+        return err;
+    x->type=LCD_XFER_FLIP;
+    x->addr=addr;
+    lcd_submit();
+    return 0;
+}
+
+/* queue a move of the viewport, paced by the frame clock like a flip */
+static int lcd_set_viewport(struct file *file, const struct t6963_viewport *vp) {
+    unsigned long home;
+
+    home=lcd_canvas_base+(unsigned long)vp->y*lcd_stat.row_width+vp->x;
+    if(vp->x>=LCD_RAM_SIZE || vp->y>=LCD_RAM_SIZE || 
+            home+(8*lcd_stat.rows-1)*lcd_stat.row_width+lcd_stat.cols>
+            lcd_stat.graphics_end)
+        return -EINVAL;
+    return lcd_queue_flip(file, home);
+}
+
+unsigned int t6963_poll(struct file *file, poll_table *wait) {
+    poll_wait(file, &lcd_done_wait, wait);
+    return LCD_RING_FULL ? 0 : POLLOUT | POLLWRNORM;
+}
+
+/* wait for everything queued so far to reach the LCD */
+int t6963_fsync(struct file *file, struct dentry *dentry, int datasync) {
+    int err;
+
+    if(wait_event_interruptible(lcd_done_wait, LCD_RING_EMPTY))
+        return -ERESTARTSYS;
+    err=lcd_ring_err;
+    lcd_ring_err=0;
+    return err;
+}
+
+/* the ioctls that talk to the LCD directly, run with the queue drained */
+static int t6963_ioctl_sync(unsigned int cmd, unsigned long arg) {
+    static struct t6963_charset charset;   // too big for the stack
+    struct t6963_glyph glyph;
     unsigned int addr;
 
     switch(cmd) {
         case T6963_RESET:
-            lcd_reset(LCD_ROWS, LCD_COLS);
+            t6963_reset();
             break;
         case T6963_TEXT_ON:
             if(*((unsigned char*)arg)) {
@@ -98,12 +659,6 @@ int t6963_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
         case T6963_GRAPHICS_MODE:
             lcd_stat.entry_mode=0;
             break;
-        case T6963_ADDR:
-            copy_from_user(&addr, (unsigned int*)arg, 2);
-            if(LCD_DEBUG>2)
-                printk("address: 0x%04x\n", addr);
-            lcd_cmd_long(addr, CMD_ADDR_PTR);
-            break;
         case T6963_CLEAR_GRAPHICS:
             lcd_graphics_clear();
             break;
@@ -115,24 +670,146 @@ int t6963_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
                     sizeof(struct t6963_status));    
             break;
         case T6963_SET_GRAPHICS_BASE:
-            copy_from_user(&(lcd_stat.graphics_base), (unsigned int*)arg, 2);
+            addr=0;
+            copy_from_user(&addr, (unsigned int*)arg, 2);
+            if(addr<2 || addr>=lcd_stat.graphics_end)
+                return -EINVAL;
+            lcd_stat.graphics_base=addr;
+            lcd_canvas_base=lcd_stat.graphics_base;
             lcd_cmd_long(lcd_stat.graphics_base-2, CMD_GRAPHIC_HOME_ADDR); 
             break;
         case T6963_SET_TEXT_BASE:
             copy_from_user(&(lcd_stat.text_base), (unsigned int*)arg, 2);
-            lcd_cmd_long(lcd_stat.text_base-2, CMD_TEXT_HOME_ADDR); 
+            lcd_set_text_home(lcd_stat.text_base);
+            break;
+        case T6963_SET_GRAPHICS_AREA:
+            if(copy_from_user(&addr, (unsigned int*)arg, sizeof(addr)))
+                return -EFAULT;
+            return lcd_set_graphics_area(addr);
+        case T6963_SET_CHARSET:
+            if(copy_from_user(&charset, (struct t6963_charset*)arg, sizeof(charset)))
+                return -EFAULT;
+            if(lcd_set_charset(charset.type, charset.map)<0)
+                return -EINVAL;
+            break;
+        case T6963_READ_HW:
+            if(copy_from_user(&addr, (unsigned int*)arg, sizeof(addr)))
+                return -EFAULT;
+            lcd_read_hw=addr!=0;
+            break;
+        case T6963_DEFINE_GLYPH:
+            if(copy_from_user(&glyph, (struct t6963_glyph*)arg, sizeof(glyph)))
+                return -EFAULT;
+            if(lcd_define_glyph(glyph.code, glyph.bits)<0)
+                return -ENOSPC;
             break;
     }
     return 0;
 }
 
+int t6963_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
+                unsigned long arg) {
+    struct t6963_rect rect;
+    struct t6963_range range;
+    struct t6963_planes planes;
+    struct t6963_viewport vp;
+    struct t6963_fill fill;
+    struct t6963_draw draw;
+    unsigned int val;
+    int ret;
+
+    // uploads are queued like write()
+    switch(cmd) {
+        case T6963_ADDR:
+            val=0;
+            copy_from_user(&val, (unsigned int*)arg, 2);
+            if(LCD_DEBUG>2)
+                printk("address: 0x%04x\n", val);
+            // the address pointer is sent with the next dirty run, writes
+            // already queued took their address with them
+            if(down_interruptible(&lcd_submit_sem))
+                return -ERESTARTSYS;
+            lcd_addr_ptr=val&0xffff;
+            up(&lcd_submit_sem);
+            return 0;
+        case T6963_WRITE_RECT:
+            if(copy_from_user(&rect, (struct t6963_rect*)arg, sizeof(rect)))
+                return -EFAULT;
+            return lcd_write_rect(file, &rect);
+        case T6963_FILL:
+            if(copy_from_user(&fill, (struct t6963_fill*)arg, sizeof(fill)))
+                return -EFAULT;
+            return lcd_fill_rect(file, &fill);
+        case T6963_DRAW:
+            if(copy_from_user(&draw, (struct t6963_draw*)arg, sizeof(draw)))
+                return -EFAULT;
+            return lcd_draw_cmds(file, &draw);
+        case T6963_FLUSH:
+            if(!arg)
+                return lcd_flush(file, 0, LCD_RAM_SIZE);
+            if(copy_from_user(&range, (struct t6963_range*)arg, sizeof(range)))
+                return -EFAULT;
+            return lcd_flush(file, range.addr, range.len);
+        case T6963_QUEUE_FLIP:
+            if(copy_from_user(&val, (unsigned int*)arg, sizeof(val)))
+                return -EFAULT;
+            return lcd_queue_flip(file, val);
+        case T6963_WAIT_FRAME:
+            if(lcd_wait_frame())
+                return -ERESTARTSYS;
+            // the user gets the low bits of the count, whatever its size
+            val=lcd_frame_seq;
+            if(arg && copy_to_user((unsigned int*)arg, &val, sizeof(val)))
+                return -EFAULT;
+            return 0;
+        case T6963_SET_FRAME_RATE:
+            if(copy_from_user(&val, (unsigned int*)arg, sizeof(val)))
+                return -EFAULT;
+            if(val>1000)
+                return -EINVAL;
+            lcd_frame_clock(val);
+            return 0;
+        case T6963_SET_PLANES:
+            if(copy_from_user(&planes, (struct t6963_planes*)arg, sizeof(planes)))
+                return -EFAULT;
+            return lcd_set_planes(&planes);
+        case T6963_SET_VIEWPORT:
+            if(copy_from_user(&vp, (struct t6963_viewport*)arg, sizeof(vp)))
+                return -EFAULT;
+            return lcd_set_viewport(file, &vp);
+    }
+
+    if(lcd_sync_begin())
+        return -ERESTARTSYS;
+    ret=t6963_ioctl_sync(cmd, arg);
+    lcd_sync_end();
+    return ret;
+}
+
+int t6963_mmap(struct file *file, struct vm_area_struct *vma) {
+    unsigned long size=vma->vm_end-vma->vm_start;
+    unsigned long off=vma->vm_pgoff<<PAGE_SHIFT;
+
+    if(off+size>PAGE_ALIGN(LCD_RAM_SIZE))
+        return -EINVAL;
+
+    vma->vm_flags |= VM_RESERVED;
+    if(remap_pfn_range(vma, vma->vm_start, 
+                (virt_to_phys(lcd_vram)+off)>>PAGE_SHIFT, size, vma->vm_page_prot))
+        return -EAGAIN;
+    return 0;
+}
+
 int t6963_close(struct inode *indoe, struct file *file) {
     return 0;
 }
 
 int t6963_open(struct inode *inode, struct file *file) {
-    if(lcd_reset(LCD_ROWS, LCD_COLS)<0)
+    if(lcd_sync_begin())
+        return -ERESTARTSYS;
+    if(t6963_reset()<0)
         printk("t6963: reset failed!\n");
+    lcd_sync_end();
     return 0;
 }
 
@@ -142,23 +819,93 @@ static struct file_operations t6963_fops = {
     write: t6963_write,
     read: t6963_read,
     ioctl: t6963_ioctl,
+    mmap: t6963_mmap,
+    poll: t6963_poll,
+    fsync: t6963_fsync,
 };
 
+static void t6963_free_vram(void) {
+    unsigned long page;
+
+    for(page=(unsigned long)lcd_vram;page<(unsigned long)lcd_vram+LCD_RAM_SIZE;
+            page+=PAGE_SIZE)
+        ClearPageReserved(virt_to_page(page));
+    free_pages((unsigned long)lcd_vram, LCD_VRAM_ORDER);
+}
+
 int t6963_init(void) {
+    unsigned long page;
+    int i, err;
+
+    if((err=lcd_claim_port("t6963"))<0)
+        return err;
+
+    lcd_vram=(u8*)__get_free_pages(GFP_KERNEL, LCD_VRAM_ORDER);
+    if(!lcd_vram) {
+        printk("t6963: can't allocate display memory image\n");
+        lcd_release_port();
+        return -ENOMEM;
+    }
+    // keep the pages around for remap_pfn_range()
+    for(page=(unsigned long)lcd_vram;page<(unsigned long)lcd_vram+LCD_RAM_SIZE;
+            page+=PAGE_SIZE)
+        SetPageReserved(virt_to_page(page));
+
+    lcd_ring_data=vmalloc(LCD_RING_SLOTS*LCD_RAM_SIZE);
+    if(!lcd_ring_data) {
+        printk("t6963: can't allocate transfer queue\n");
+        t6963_free_vram();
+        lcd_release_port();
+        return -ENOMEM;
+    }
+    for(i=0;i<LCD_RING_SLOTS;i++)
+        lcd_ring[i].data=lcd_ring_data+i*LCD_RAM_SIZE;
+
+    if(t6963_reset()<0)
+        printk("t6963: reset failed!\n");
+
+    hrtimer_init(&lcd_frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    lcd_frame_timer.function=lcd_frame_tick;
+    lcd_frame_clock(lcd_frame_rate);
+    hrtimer_init(&lcd_plane_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    lcd_plane_timer.function=lcd_plane_tick;
+
+    lcd_thread=kthread_run(lcd_flush_thread, NULL, "t6963");
+    if(IS_ERR(lcd_thread)) {
+        printk("t6963: can't start flush thread\n");
+        hrtimer_cancel(&lcd_frame_timer);
+        vfree(lcd_ring_data);
+        t6963_free_vram();
+        lcd_release_port();
+        return PTR_ERR(lcd_thread);
+    }
+
     if((lcd_major=register_chrdev(0, "t6963", &t6963_fops)) == -EBUSY) {
         printk("Can't register t6963 driver\n");
+        kthread_stop(lcd_thread);
+        hrtimer_cancel(&lcd_plane_timer);
+        hrtimer_cancel(&lcd_frame_timer);
+        vfree(lcd_ring_data);
+        t6963_free_vram();
+        lcd_release_port();
         return -EIO;
     }
     printk("t6963: init successful, major number %d\n", lcd_major);
 
-    if(lcd_reset(LCD_ROWS, LCD_COLS)<0)
-        printk("t6963: reset failed!\n");
-
     return 0;
 }
 
 void t6963_exit(void) {
     unregister_chrdev(lcd_major, "t6963");
+
+    // the thread sends whatever is still queued before it stops
+    hrtimer_cancel(&lcd_plane_timer);
+    kthread_stop(lcd_thread);
+    hrtimer_cancel(&lcd_frame_timer);
+    vfree(lcd_ring_data);
+    t6963_free_vram();
+    lcd_release_port();
+
     printk("t6963: driver unloaded\n");
 }
 
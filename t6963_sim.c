@@ -0,0 +1,202 @@
+/*******************************************************************************
+ * T6963C simulator bus backend
+ *
+ * Models enough of the T6963C to run the driver without a panel: the display
+ * RAM, the data stack that command arguments are pushed onto, the address
+ * pointer, auto read/write mode and the registers set by the commands in
+ * t6963_commands.h. Load the driver with lcd_bus_type=sim to use it.
+ *
+ * Nothing here touches a port, but every phase is accounted in lcd_bus_stats
+ * exactly like the parallel port backend would have paid for it, so numbers
+ * taken against the simulator compare with the real thing.
+ *
+ * Included from t6963.c, not built on its own.
+ *
+ ******************************************************************************/
+
+static struct {
+    u8 ram[LCD_RAM_SIZE];
+    u8 data[2];             // data stack, arguments for the next command
+    int ndata;
+    u16 addr;               // address pointer
+    u8 auto_mode;           // 0, CMD_AUTO_WRITE or CMD_AUTO_READ
+    u8 readback;            // result of the last single read command
+
+    u8 mode;                // CMD_MODESET bits
+    u8 display;             // CMD_DISPLAYMODE bits
+    u8 cursor_lines;
+    u8 offset;
+    u16 text_home, text_area;
+    u16 graphic_home, graphic_area;
+    u8 cursor_x, cursor_y;
+
+    unsigned long errors;   // commands the real thing would have choked on
+} lcd_sim;
+
+/* what lcd_ctrl_out() would have cost on the parallel port */
+static inline void lcd_sim_ctrl(u8 ctrl) {
+    if(ctrl==lcd_ctrl)
+        return;
+    lcd_ctrl=ctrl;
+    lcd_bus_stats.port_writes++;
+}
+
+/* account for one bus cycle the way the pport backend runs it */
+static void lcd_sim_cycle(u8 ctrl, const int *timing, int data_out) {
+    if(data_out)
+        lcd_bus_stats.port_writes++;
+    else
+        lcd_bus_stats.port_reads++;
+
+    lcd_sim_ctrl(ctrl);
+    LCD_DELAY(timing, T_SETUP);
+    lcd_sim_ctrl(ctrl | lcd_ctrl_ce);
+    LCD_DELAY(timing, T_PULSE);
+    lcd_sim_ctrl(lcd_ctrl_idle);
+    LCD_DELAY(timing, T_HOLD);
+}
+
+static void lcd_sim_reset(void) {
+    memset(&lcd_sim, 0, sizeof(lcd_sim));
+}
+
+static inline u16 lcd_sim_arg(void) {
+    return lcd_sim.data[0] | (lcd_sim.data[1]<<8);
+}
+
+static void lcd_sim_exec(u8 cmd) {
+    u8 *cell=&lcd_sim.ram[lcd_sim.addr % LCD_RAM_SIZE];
+
+    if(lcd_sim.auto_mode) {
+        // only the auto reset command is taken in auto mode
+        if((cmd & 0xfe)==CMD_AUTO_RESET)
+            lcd_sim.auto_mode=0;
+        else
+            lcd_sim.errors++;
+        lcd_sim.ndata=0;
+        return;
+    }
+
+    switch(cmd & 0xf0) {
+        case 0x20:
+            if(cmd==CMD_CURSOR_POS) {
+                lcd_sim.cursor_x=lcd_sim.data[0];
+                lcd_sim.cursor_y=lcd_sim.data[1];
+            } else if(cmd==CMD_OFFSET_REG) {
+                lcd_sim.offset=lcd_sim.data[0];
+            } else if(cmd==CMD_ADDR_PTR) {
+                lcd_sim.addr=lcd_sim_arg();
+            } else {
+                lcd_sim.errors++;
+            }
+            break;
+        case 0x40:
+            if(cmd==CMD_TEXT_HOME_ADDR)
+                lcd_sim.text_home=lcd_sim_arg();
+            else if(cmd==CMD_TEXT_AREA_SET)
+                lcd_sim.text_area=lcd_sim_arg();
+            else if(cmd==CMD_GRAPHIC_HOME_ADDR)
+                lcd_sim.graphic_home=lcd_sim_arg();
+            else if(cmd==CMD_GRAPHIC_AREA_SET)
+                lcd_sim.graphic_area=lcd_sim_arg();
+            else
+                lcd_sim.errors++;
+            break;
+        case CMD_MODESET:
+            lcd_sim.mode=cmd & 0x0f;
+            break;
+        case CMD_DISPLAYMODE:
+            lcd_sim.display=cmd & 0x0f;
+            break;
+        case CMD_CURSOR:
+            lcd_sim.cursor_lines=(cmd & 0x07)+1;
+            break;
+        case 0xb0:
+            if(cmd==CMD_AUTO_WRITE || cmd==CMD_AUTO_READ)
+                lcd_sim.auto_mode=cmd;
+            else if((cmd & 0xfe)!=CMD_AUTO_RESET)
+                lcd_sim.errors++;
+            break;
+        case 0xc0:
+            if(cmd & 0x01)
+                lcd_sim.readback=*cell;
+            else
+                *cell=lcd_sim.data[0];
+
+            if((cmd & 0x06)==0x00)
+                lcd_sim.addr++;
+            else if((cmd & 0x06)==0x02)
+                lcd_sim.addr--;
+            else if((cmd & 0x06)!=0x04)
+                lcd_sim.errors++;
+            break;
+        case CMD_BIT_SET:
+            if(cmd & BIT_SET)
+                *cell |= 1<<(cmd & 0x07);
+            else
+                *cell &= ~(1<<(cmd & 0x07));
+            break;
+        default:
+            lcd_sim.errors++;
+    }
+    lcd_sim.ndata=0;
+}
+
+static u8 lcd_sim_status_rd(void) {
+    lcd_sim_cycle(lcd_ctrl_status_rd, lcd_status_timing, 0);
+
+    // the real thing keeps STA0/1 up in auto mode too, which is what lets
+    // lcd_cmd() send the auto reset
+    if(lcd_sim.auto_mode==CMD_AUTO_WRITE)
+        return STATUS_AUTO_WR | STATUS_CMD | STATUS_RW | STATUS_RDY;
+    if(lcd_sim.auto_mode==CMD_AUTO_READ)
+        return STATUS_AUTO_RD | STATUS_CMD | STATUS_RW | STATUS_RDY;
+    return STATUS_CMD | STATUS_RW | STATUS_RDY;
+}
+
+static void lcd_sim_cmd_wr(u8 cmd) {
+    lcd_sim_cycle(lcd_ctrl_cmd_wr, lcd_cmd_timing, 1);
+    lcd_sim_exec(cmd);
+}
+
+static void lcd_sim_data_wr(u8 data) {
+    lcd_sim_cycle(lcd_ctrl_data_wr, lcd_data_timing, 1);
+
+    if(lcd_sim.auto_mode==CMD_AUTO_WRITE) {
+        lcd_sim.ram[lcd_sim.addr++ % LCD_RAM_SIZE]=data;
+        return;
+    }
+    if(lcd_sim.auto_mode) {
+        lcd_sim.errors++;
+        return;
+    }
+
+    // the stack only holds two, older arguments fall off the bottom
+    if(lcd_sim.ndata==2) {
+        lcd_sim.data[0]=lcd_sim.data[1];
+        lcd_sim.ndata=1;
+    }
+    lcd_sim.data[lcd_sim.ndata++]=data;
+}
+
+static u8 lcd_sim_data_rd(void) {
+    lcd_sim_cycle(lcd_ctrl_data_rd, lcd_read_timing, 0);
+
+    if(lcd_sim.auto_mode==CMD_AUTO_READ)
+        return lcd_sim.ram[lcd_sim.addr++ % LCD_RAM_SIZE];
+    if(lcd_sim.auto_mode)
+        lcd_sim.errors++;
+    return lcd_sim.readback;
+}
+
+static void lcd_sim_delay(unsigned int ns) {
+}
+
+static struct lcd_bus_ops lcd_sim_ops = {
+    .name =         "sim",
+    .status_rd =    lcd_sim_status_rd,
+    .cmd_wr =       lcd_sim_cmd_wr,
+    .data_wr =      lcd_sim_data_wr,
+    .data_rd =      lcd_sim_data_rd,
+    .delay =        lcd_sim_delay,
+};